@@ -2,7 +2,9 @@
 
 #include <vulkan/vulkan.h>
 
+#include <cstdint>
 #include <span>
+#include <string_view>
 
 struct CompiledSpv {
     VkShaderStageFlagBits stage;
@@ -22,6 +24,7 @@ struct CompiledPipeline {
     bool depth_test;
     bool depth_write;
     uint8_t stage_count;
+    uint8_t fingerprint[32]; // hash of everything the pipeline was built from, lets the compiler reuse it when nothing changed
     CompiledSpv stages[5]; //
 
     char data[];
@@ -33,9 +36,39 @@ struct CompiledPipeline {
     }
 };
 
+// A pipeline generated from the "variants" block of a material. The block's macros are taken in alphabetical
+// order and each one gets the bits it needs for the index of its value in the list, the first macro in the
+// lowest bits. {"LIGHTS": [1, 2, 4, 8], "SHADOW": [0, 1]} with LIGHTS = 4 and SHADOW = 1 is mask 2 | 1 << 2.
+struct PipelineVariant {
+    uint32_t name_hash;       // pipeline_name_hash of the name in the material, the pipelines are named "<name>#<mask>"
+    uint32_t variant_mask;
+    uint32_t pipeline_offset; // from the start of the database
+};
+
+// FNV-1a
+inline uint32_t pipeline_name_hash(std::string_view name) {
+    uint32_t hash = 2166136261u;
+    for (char c : name) {
+        hash = (hash ^ uint8_t(c)) * 16777619u;
+    }
+    return hash;
+}
+
+// "SHDB", the first bytes of every database
+constexpr uint32_t SHADER_DB_MAGIC = 0x42444853;
+// changes whenever the layout of anything in the database does
+constexpr uint32_t SHADER_DB_VERSION = 1;
+
 struct ShaderDBHeader {
+    uint32_t magic;
+    uint32_t version;
     uint32_t total_size;
     uint32_t shader_count;
+    uint32_t variant_count;
+    uint32_t variant_table_offset; // from the start of the database, the table follows the pipelines
 
     char data[];
+
+    // nothing else in a database that fails this can be trusted
+    bool is_current() const { return magic == SHADER_DB_MAGIC && version == SHADER_DB_VERSION; }
 };
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 #include <cstring>
@@ -9,7 +10,10 @@
 
 class ShaderDB {
 public:
-    void load_db(ShaderDBHeader* db_header) {
+    // false if db_header isn't a database of the version this was built with, nothing is loaded then
+    bool load_db(ShaderDBHeader* db_header) {
+        if (!db_header->is_current()) return false;
+
         size_t size = db_header->total_size;
         auto* copy  = reinterpret_cast<ShaderDBHeader*>(malloc(size));
         memcpy(copy, db_header, size);
@@ -24,20 +28,44 @@ public:
             cursor += pipeline->total_size;
         }
 
+        auto* variants = reinterpret_cast<PipelineVariant*>(reinterpret_cast<char*>(copy) + copy->variant_table_offset);
+        for (uint32_t i = 0; i < copy->variant_count; ++i) {
+            auto* pipeline = reinterpret_cast<CompiledPipeline*>(reinterpret_cast<char*>(copy) + variants[i].pipeline_offset);
+
+            m_variants.emplace(variant_key(variants[i].name_hash, variants[i].variant_mask), pipeline);
+        }
+
         m_dbs.push_back(copy);
+        return true;
     }
 
     CompiledPipeline* get_pipeline_db(const char* name) {
         return m_pipelinedbs[name];
     }
 
+    // a pipeline of the "variants" block of the pipeline called name in the material, see PipelineVariant for the mask
+    CompiledPipeline* get_pipeline_variant(std::string_view name, uint32_t variant_mask) {
+        auto range = m_variants.equal_range(variant_key(pipeline_name_hash(name), variant_mask));
+
+        // different names can hash the same
+        for (auto it = range.first; it != range.second; ++it) {
+            std::string_view variant_name(it->second->shader_name, strnlen(it->second->shader_name, sizeof(it->second->shader_name)));
+            if (variant_name.size() > name.size() && variant_name.starts_with(name) && variant_name[name.size()] == '#') return it->second;
+        }
+        return nullptr;
+    }
+
     ~ShaderDB() {
         for (auto* db : m_dbs) {
             free(db);
         }
     }
 
+private:
+    static uint64_t variant_key(uint32_t name_hash, uint32_t variant_mask) { return uint64_t(name_hash) << 32 | variant_mask; }
+
 private:
     std::unordered_map<std::string, CompiledPipeline*> m_pipelinedbs;
+    std::unordered_multimap<uint64_t, CompiledPipeline*> m_variants;
     std::vector<ShaderDBHeader*> m_dbs;
 };
\ No newline at end of file
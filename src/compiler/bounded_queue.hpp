@@ -0,0 +1,76 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <type_traits>
+#include <vector>
+
+// Blocking queue with a fixed capacity connecting two stages of the build.
+// With a Compare, the largest element according to it is popped first instead of the oldest one.
+template <typename T, typename Compare = void>
+class BoundedQueue {
+public:
+    BoundedQueue(size_t capacity) : m_capacity(capacity) {}
+
+    // blocks while the queue is full, returns false if the queue has been closed
+    bool push(T value) {
+        std::unique_lock lock(m_mutex);
+        m_not_full.wait(lock, [&] { return m_closed || m_items.size() < m_capacity; });
+        if (m_closed) return false;
+
+        m_items.push(std::move(value));
+        m_not_empty.notify_one();
+        return true;
+    }
+
+    // like push but gives up instead of blocking when the queue is full
+    bool try_push(T value) {
+        std::lock_guard lock(m_mutex);
+        if (m_closed || m_items.size() >= m_capacity) return false;
+
+        m_items.push(std::move(value));
+        m_not_empty.notify_one();
+        return true;
+    }
+
+    // blocks while the queue is empty, returns nullopt once it is closed and drained
+    std::optional<T> pop() {
+        std::unique_lock lock(m_mutex);
+        m_not_empty.wait(lock, [&] { return m_closed || !m_items.empty(); });
+        if (m_items.empty()) return std::nullopt;
+
+        T value;
+        if constexpr (std::is_void_v<Compare>) {
+            value = std::move(m_items.front());
+        } else {
+            value = std::move(const_cast<T&>(m_items.top()));
+        }
+        m_items.pop();
+
+        m_not_full.notify_one();
+        return value;
+    }
+
+    // no more pushes, consumers drain what is left
+    void close() {
+        std::lock_guard lock(m_mutex);
+        m_closed = true;
+        m_not_full.notify_all();
+        m_not_empty.notify_all();
+    }
+
+    BoundedQueue(const BoundedQueue&)            = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+private:
+    using Container = std::conditional_t<std::is_void_v<Compare>, std::queue<T>, std::priority_queue<T, std::vector<T>, Compare>>;
+
+    std::mutex m_mutex;
+    std::condition_variable m_not_full;
+    std::condition_variable m_not_empty;
+    Container m_items;
+    size_t m_capacity;
+    bool m_closed = false;
+};
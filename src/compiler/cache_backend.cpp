@@ -0,0 +1,142 @@
+#include "cache_backend.hpp"
+
+#include <fstream>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+const uint32_t SPIRV_MAGIC = 0x07230203;
+
+bool CacheBackend::load(const Hash& key, std::vector<uint32_t>& out_spv) {
+    // a truncated or foreign entry is treated like a miss and gets overwritten
+    if (!fetch(key, out_spv) || out_spv.empty() || out_spv[0] != SPIRV_MAGIC) {
+        out_spv.clear();
+        m_misses++;
+        return false;
+    }
+
+    m_hits++;
+    return true;
+}
+
+DirectoryCacheBackend::DirectoryCacheBackend(const fs::path& directory, uint64_t max_bytes) {
+    m_directory = fs::absolute(directory);
+    fs::create_directories(m_directory);
+
+    m_index = std::make_unique<CacheIndex>(m_directory / "index", max_bytes, [this](const Hash& key) {
+        std::error_code ec;
+        fs::remove(entry_path(key), ec);
+    });
+
+    if (m_index->was_created()) {
+        // other processes may be storing and trimming meanwhile, a file that is gone is skipped and anything
+        // the scan misses is recorded on its first hit
+        std::error_code ec;
+        for (auto it = fs::recursive_directory_iterator(m_directory, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+            fs::path path = it->path();
+
+            Hash key;
+            if (path.extension() != ".spv" || !from_hex(path.parent_path().filename().native() + path.stem().native(), key)) continue;
+
+            std::error_code size_ec;
+            uint64_t size = it->file_size(size_ec);
+            if (!size_ec) m_index->record_store(key, size);
+        }
+    }
+}
+
+fs::path DirectoryCacheBackend::entry_path(const Hash& key) const {
+    std::string hex = to_hex(key);
+
+    // two level layout so no single directory gets huge
+    return m_directory / hex.substr(0, 2) / (hex.substr(2) + ".spv");
+}
+
+bool DirectoryCacheBackend::fetch(const Hash& key, std::vector<uint32_t>& out_spv) {
+    fs::path path = entry_path(key);
+
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    size_t size = file.is_open() ? static_cast<size_t>(file.tellg()) : 0;
+
+    if (!file.is_open()) {
+        // deleted behind the index's back, it would count against the size cap forever
+        m_index->record_missing(key, [&] {
+            std::error_code ec;
+            return !fs::exists(path, ec) && !ec;
+        });
+    }
+
+    if (size > 0 && size % sizeof(uint32_t) == 0) {
+        out_spv.resize(size / sizeof(uint32_t));
+
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(out_spv.data()), size);
+
+        if (file) {
+            m_index->record_hit(key, size);
+            return true;
+        }
+    }
+
+    m_index->record_miss();
+    return false;
+}
+
+void DirectoryCacheBackend::store(const Hash& key, std::span<const uint32_t> spv) {
+    fs::path path = entry_path(key);
+
+    std::error_code ec;
+    fs::create_directories(path.parent_path(), ec);
+
+    fs::path tmp_path = path;
+    tmp_path += ".tmp" + std::to_string(getpid()) + "." + std::to_string(m_tmp_count++);
+
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) return;
+
+        file.write(reinterpret_cast<const char*>(spv.data()), spv.size_bytes());
+        if (!file) {
+            file.close();
+            fs::remove(tmp_path, ec);
+            return;
+        }
+    }
+
+    // renamed under the index lock so a running trim can't delete the new file for an older eviction of the key
+    m_index->record_store(key, spv.size_bytes(), [&] {
+        fs::rename(tmp_path, path, ec);
+        if (!ec) return true;
+
+        std::error_code remove_ec;
+        fs::remove(tmp_path, remove_ec);
+        return false;
+    });
+}
+
+bool MemoryCacheBackend::fetch(const Hash& key, std::vector<uint32_t>& out_spv) {
+    std::lock_guard lock(m_mutex);
+
+    auto it = m_entries.find(key);
+    if (it == m_entries.end()) return false;
+
+    out_spv = it->second;
+    return true;
+}
+
+void MemoryCacheBackend::store(const Hash& key, std::span<const uint32_t> spv) {
+    std::lock_guard lock(m_mutex);
+
+    auto [it, inserted] = m_entries.try_emplace(key, spv.begin(), spv.end());
+    if (!inserted) return;
+
+    m_insertion_order.push_back(key);
+    m_bytes += spv.size_bytes();
+
+    while (m_bytes > m_max_bytes && m_insertion_order.size() > 1) {
+        auto oldest = m_entries.find(m_insertion_order.front());
+        m_bytes -= oldest->second.size() * sizeof(uint32_t);
+        m_entries.erase(oldest);
+        m_insertion_order.pop_front();
+    }
+}
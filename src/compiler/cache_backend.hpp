@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "cache_index.hpp"
+#include "hash.hpp"
+
+// Storage for compiled SPIR-V addressed by the hash of the compilation inputs.
+class CacheBackend {
+public:
+    virtual ~CacheBackend() = default;
+
+    virtual const char* name() const = 0;
+
+    // counts the hit or miss; anything that doesn't look like SPIR-V is a miss
+    bool load(const Hash& key, std::vector<uint32_t>& out_spv);
+    virtual void store(const Hash& key, std::span<const uint32_t> spv) = 0;
+
+    size_t hits() const { return m_hits; }
+    size_t misses() const { return m_misses; }
+
+protected:
+    virtual bool fetch(const Hash& key, std::vector<uint32_t>& out_spv) = 0;
+
+private:
+    std::atomic<size_t> m_hits   = 0;
+    std::atomic<size_t> m_misses = 0;
+};
+
+constexpr uint64_t DEFAULT_CACHE_MAX_MB = 2048;
+
+// Cache in a local directory. Entries are written to a temporary file and renamed into place,
+// so several compiler processes can share a directory.
+// The directory is kept under max_bytes by evicting the least recently used entries in the background.
+class DirectoryCacheBackend : public CacheBackend {
+public:
+    DirectoryCacheBackend(const std::filesystem::path& directory, uint64_t max_bytes);
+
+    const char* name() const override { return "shader cache"; }
+
+    void store(const Hash& key, std::span<const uint32_t> spv) override;
+
+    // over every process that used the directory
+    CacheStats stats() const { return m_index->stats(); }
+
+protected:
+    bool fetch(const Hash& key, std::vector<uint32_t>& out_spv) override;
+
+private:
+    std::filesystem::path entry_path(const Hash& key) const;
+
+private:
+    std::filesystem::path m_directory;
+    std::unique_ptr<CacheIndex> m_index;
+
+    std::atomic<uint64_t> m_tmp_count = 0;
+};
+
+// SPIR-V a compile server or --watch session keeps in memory across builds
+constexpr uint64_t DEFAULT_MEMORY_CACHE_MB = 1024;
+
+// Cache in this process's memory, for a long running compile server or --watch session. The oldest entries
+// are dropped once they add up to more than max_bytes.
+class MemoryCacheBackend : public CacheBackend {
+public:
+    MemoryCacheBackend(uint64_t max_bytes) { m_max_bytes = max_bytes; }
+
+    const char* name() const override { return "memory cache"; }
+
+    void store(const Hash& key, std::span<const uint32_t> spv) override;
+
+protected:
+    bool fetch(const Hash& key, std::vector<uint32_t>& out_spv) override;
+
+private:
+    std::mutex m_mutex;
+    std::unordered_map<Hash, std::vector<uint32_t>, HashHasher> m_entries;
+    std::deque<Hash> m_insertion_order;
+    uint64_t m_bytes = 0;
+    uint64_t m_max_bytes;
+};
@@ -0,0 +1,305 @@
+#include "cache_index.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+const uint64_t CACHE_INDEX_MAGIC = 0x5844494843414353;
+const uint32_t INDEX_CAPACITY    = 1 << 16;
+
+// a trim goes a bit below the limits so it doesn't have to run again right away
+const double TRIM_TARGET = 0.9;
+
+enum EntryState : uint32_t {
+    ENTRY_EMPTY   = 0,
+    ENTRY_FILLED  = 1,
+    ENTRY_DELETED = 2,
+};
+
+struct CacheIndexHeader {
+    uint64_t magic;
+    uint32_t capacity;
+    uint32_t reserved;
+    std::atomic<uint64_t> entry_count;
+    std::atomic<uint64_t> total_bytes;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> evictions;
+};
+
+struct CacheIndexEntry {
+    Hash key;
+    std::atomic<uint32_t> state; // readers only trust key and size once this is ENTRY_FILLED
+    uint32_t reserved;
+    std::atomic<uint64_t> size;
+    std::atomic<uint64_t> last_access_ms;
+};
+
+static uint64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static size_t slot_of(const Hash& key) {
+    uint64_t bits;
+    memcpy(&bits, key.data(), sizeof(bits));
+    return bits % INDEX_CAPACITY;
+}
+
+CacheIndex::CacheIndex(const std::filesystem::path& file_name, uint64_t max_bytes, std::function<void(const Hash&)> remove_entry) {
+    m_max_bytes    = max_bytes;
+    m_remove_entry = std::move(remove_entry);
+    m_mapped_size  = sizeof(CacheIndexHeader) + INDEX_CAPACITY * sizeof(CacheIndexEntry);
+
+    m_fd = open(file_name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        throw std::runtime_error("failed to open cache index: " + file_name.native());
+    }
+
+    lock_file();
+
+    // a missing, foreign or differently sized index is started from scratch
+    CacheIndexHeader existing{};
+    bool valid = pread(m_fd, &existing, sizeof(existing), 0) == sizeof(existing) && existing.magic == CACHE_INDEX_MAGIC && existing.capacity == INDEX_CAPACITY;
+    if (!valid && (ftruncate(m_fd, 0) != 0 || ftruncate(m_fd, m_mapped_size) != 0)) {
+        unlock_file();
+        close(m_fd);
+        throw std::runtime_error("failed to size cache index: " + file_name.native());
+    }
+
+    void* base = mmap(nullptr, m_mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (base == MAP_FAILED) {
+        unlock_file();
+        close(m_fd);
+        throw std::runtime_error("failed to map cache index: " + file_name.native());
+    }
+
+    m_header  = reinterpret_cast<CacheIndexHeader*>(base);
+    m_entries = reinterpret_cast<CacheIndexEntry*>(m_header + 1);
+
+    if (!valid) {
+        m_header->magic    = CACHE_INDEX_MAGIC;
+        m_header->capacity = INDEX_CAPACITY;
+    }
+    m_created = !valid;
+
+    unlock_file();
+
+    m_trimmer = std::thread([this] {
+        std::unique_lock lock(m_trim_mutex);
+        while (true) {
+            m_trim_cv.wait(lock, [&] { return m_trim_requested || m_stop; });
+            if (!m_trim_requested) return;
+
+            m_trim_requested = false;
+            lock.unlock();
+            trim();
+            lock.lock();
+        }
+    });
+
+    request_trim();
+}
+
+CacheIndex::~CacheIndex() {
+    {
+        std::lock_guard lock(m_trim_mutex);
+        m_stop = true;
+    }
+    m_trim_cv.notify_one();
+    m_trimmer.join();
+
+    munmap(m_header, m_mapped_size);
+    close(m_fd);
+}
+
+void CacheIndex::lock_file() const {
+    // flock only keeps other processes out, the threads of this one share the descriptor and its lock
+    m_thread_mutex.lock();
+    while (flock(m_fd, LOCK_EX) != 0 && errno == EINTR) {}
+}
+
+void CacheIndex::unlock_file() const {
+    flock(m_fd, LOCK_UN);
+    m_thread_mutex.unlock();
+}
+
+CacheIndexEntry* CacheIndex::find(const Hash& key) const {
+    // lock free, an entry that is being written isn't FILLED yet
+    for (size_t i = 0, slot = slot_of(key); i < INDEX_CAPACITY; ++i, slot = (slot + 1) % INDEX_CAPACITY) {
+        CacheIndexEntry& entry = m_entries[slot];
+
+        uint32_t state = entry.state.load(std::memory_order_acquire);
+        if (state == ENTRY_EMPTY) return nullptr;
+        if (state == ENTRY_FILLED && entry.key == key) return &entry;
+    }
+    return nullptr;
+}
+
+void CacheIndex::insert_locked(const Hash& key, uint64_t size) {
+    if (CacheIndexEntry* entry = find(key)) {
+        m_header->total_bytes += size - entry->size.exchange(size);
+        entry->last_access_ms = now_ms();
+        return;
+    }
+
+    for (size_t i = 0, slot = slot_of(key); i < INDEX_CAPACITY; ++i, slot = (slot + 1) % INDEX_CAPACITY) {
+        CacheIndexEntry& entry = m_entries[slot];
+        if (entry.state.load(std::memory_order_acquire) == ENTRY_FILLED) continue;
+
+        entry.key            = key;
+        entry.size           = size;
+        entry.last_access_ms = now_ms();
+        entry.state.store(ENTRY_FILLED, std::memory_order_release);
+
+        m_header->entry_count++;
+        m_header->total_bytes += size;
+        return;
+    }
+
+    // the index is full, the entry stays on disk untracked until the trim made room
+}
+
+void CacheIndex::record_hit(const Hash& key, uint64_t size) {
+    m_header->hits++;
+
+    if (CacheIndexEntry* entry = find(key)) {
+        entry->last_access_ms.store(now_ms(), std::memory_order_relaxed);
+        return;
+    }
+
+    // written by a process that didn't know about the index yet
+    lock_file();
+    insert_locked(key, size);
+    unlock_file();
+    request_trim();
+}
+
+void CacheIndex::record_miss() {
+    m_header->misses++;
+}
+
+void CacheIndex::record_store(const Hash& key, uint64_t size) {
+    record_store(key, size, [] { return true; });
+}
+
+void CacheIndex::record_store(const Hash& key, uint64_t size, const std::function<bool()>& publish) {
+    lock_file();
+    bool published = publish();
+    if (published) insert_locked(key, size);
+    unlock_file();
+
+    if (published) request_trim();
+}
+
+void CacheIndex::record_missing(const Hash& key, const std::function<bool()>& missing) {
+    if (!find(key)) return;
+
+    lock_file();
+    CacheIndexEntry* entry = find(key);
+    if (entry && missing()) {
+        entry->state.store(ENTRY_DELETED, std::memory_order_release);
+
+        m_header->total_bytes -= entry->size;
+        m_header->entry_count--;
+    }
+    unlock_file();
+}
+
+CacheStats CacheIndex::stats() const {
+    return CacheStats{
+        .entries   = m_header->entry_count,
+        .bytes     = m_header->total_bytes,
+        .hits      = m_header->hits,
+        .misses    = m_header->misses,
+        .evictions = m_header->evictions,
+    };
+}
+
+void CacheIndex::request_trim() {
+    if (m_header->total_bytes <= m_max_bytes && m_header->entry_count <= INDEX_CAPACITY * TRIM_TARGET) return;
+
+    {
+        std::lock_guard lock(m_trim_mutex);
+        m_trim_requested = true;
+    }
+    m_trim_cv.notify_one();
+}
+
+void CacheIndex::trim() {
+    struct Victim {
+        Hash key;
+        uint64_t last_access_ms;
+        uint32_t slot;
+    };
+
+    std::vector<Victim> victims;
+
+    lock_file();
+
+    uint64_t target_bytes   = m_max_bytes * TRIM_TARGET;
+    uint64_t target_entries = INDEX_CAPACITY * TRIM_TARGET * TRIM_TARGET;
+    if (m_header->total_bytes <= m_max_bytes && m_header->entry_count <= INDEX_CAPACITY * TRIM_TARGET) {
+        unlock_file();
+        return;
+    }
+
+    for (uint32_t slot = 0; slot < INDEX_CAPACITY; ++slot) {
+        CacheIndexEntry& entry = m_entries[slot];
+        if (entry.state == ENTRY_FILLED) victims.push_back(Victim{entry.key, entry.last_access_ms, slot});
+    }
+
+    std::sort(victims.begin(), victims.end(), [](const Victim& a, const Victim& b) { return a.last_access_ms < b.last_access_ms; });
+
+    size_t evicted = 0;
+    for (; evicted < victims.size() && (m_header->total_bytes > target_bytes || m_header->entry_count > target_entries); ++evicted) {
+        CacheIndexEntry& entry = m_entries[victims[evicted].slot];
+        entry.state.store(ENTRY_DELETED, std::memory_order_release);
+
+        m_header->total_bytes -= entry.size;
+        m_header->entry_count--;
+        m_header->evictions++;
+    }
+
+    // rebuild the table so the tombstones don't make every probe sequence longer,
+    // a lock free reader that misses an entry meanwhile falls back to record_hit's locked path
+    struct Remaining {
+        Hash key;
+        uint64_t size;
+        uint64_t last_access_ms;
+    };
+
+    std::vector<Remaining> remaining;
+    for (uint32_t slot = 0; slot < INDEX_CAPACITY; ++slot) {
+        CacheIndexEntry& entry = m_entries[slot];
+        if (entry.state == ENTRY_FILLED) remaining.push_back(Remaining{entry.key, entry.size, entry.last_access_ms});
+
+        entry.state.store(ENTRY_EMPTY, std::memory_order_release);
+    }
+
+    for (auto& kept : remaining) {
+        size_t slot = slot_of(kept.key);
+        while (m_entries[slot].state != ENTRY_EMPTY) {
+            slot = (slot + 1) % INDEX_CAPACITY;
+        }
+
+        CacheIndexEntry& entry = m_entries[slot];
+        entry.key              = kept.key;
+        entry.size             = kept.size;
+        entry.last_access_ms   = kept.last_access_ms;
+        entry.state.store(ENTRY_FILLED, std::memory_order_release);
+    }
+
+    // still under the lock, a process storing one of the keys again meanwhile would lose its new file
+    for (size_t i = 0; i < evicted; ++i) {
+        m_remove_entry(victims[i].key);
+    }
+
+    unlock_file();
+}
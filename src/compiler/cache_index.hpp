@@ -0,0 +1,76 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "hash.hpp"
+
+struct CacheIndexHeader;
+struct CacheIndexEntry;
+
+struct CacheStats {
+    uint64_t entries;
+    uint64_t bytes;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+// Memory mapped index of a cache directory recording the size and last access time of every entry,
+// shared by every process using the directory. Once the entries add up to more than the size cap
+// a background thread evicts the least recently used ones.
+class CacheIndex {
+public:
+    // remove_entry deletes the file of an evicted entry
+    CacheIndex(const std::filesystem::path& file_name, uint64_t max_bytes, std::function<void(const Hash&)> remove_entry);
+    // finishes a trim that is already running
+    ~CacheIndex();
+
+    void record_hit(const Hash& key, uint64_t size);
+    void record_miss();
+    void record_store(const Hash& key, uint64_t size);
+    // publish puts the entry's file into place under the index lock so a trim can't delete it in between,
+    // the entry is only recorded if it returns true
+    void record_store(const Hash& key, uint64_t size, const std::function<bool()>& publish);
+    // drops the entry of a file that turned out to be gone if missing still says so under the index lock
+    void record_missing(const Hash& key, const std::function<bool()>& missing);
+
+    CacheStats stats() const;
+
+    // true if there was no usable index yet, the entries already in the directory have to be recorded again
+    bool was_created() const { return m_created; }
+
+    CacheIndex(const CacheIndex&)            = delete;
+    CacheIndex& operator=(const CacheIndex&) = delete;
+
+private:
+    CacheIndexEntry* find(const Hash& key) const;
+    // needs the file lock
+    void insert_locked(const Hash& key, uint64_t size);
+    void request_trim();
+    void trim();
+
+    void lock_file() const;
+    void unlock_file() const;
+
+private:
+    int m_fd;
+    mutable std::mutex m_thread_mutex;
+    CacheIndexHeader* m_header;
+    CacheIndexEntry* m_entries;
+    size_t m_mapped_size;
+    bool m_created;
+
+    uint64_t m_max_bytes;
+    std::function<void(const Hash&)> m_remove_entry;
+
+    std::mutex m_trim_mutex;
+    std::condition_variable m_trim_cv;
+    bool m_trim_requested = false;
+    bool m_stop           = false;
+    std::thread m_trimmer;
+};
@@ -0,0 +1,67 @@
+#include "compile_history.hpp"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+void CompileHistory::load(const char* file_name) {
+    // a server or --watch loads again for every build, possibly of another output
+    m_previous.clear();
+    m_current.clear();
+
+    std::ifstream file(file_name);
+    if (!file.is_open()) return;
+
+    // each line is "<time_us>\t<key>"
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos) continue;
+
+        m_previous[line.substr(tab + 1)] = strtoull(line.c_str(), nullptr, 10);
+    }
+}
+
+bool CompileHistory::save(const char* file_name) const {
+    std::string tmp_name = std::string(file_name) + ".tmp";
+
+    {
+        std::ofstream file(tmp_name, std::ios::out | std::ios::trunc);
+        if (!file.is_open()) return false;
+
+        // only the jobs of this run are kept so the log doesn't grow forever
+        for (auto& [key, time_us] : m_current) {
+            file << time_us << '\t' << key << '\n';
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmp_name, file_name, ec);
+    return !ec;
+}
+
+uint64_t CompileHistory::predict(const std::string& key, uint64_t estimated_us) const {
+    auto it = m_previous.find(key);
+    return it != m_previous.end() ? it->second : estimated_us;
+}
+
+void CompileHistory::record(const std::string& key, uint64_t time_us) {
+    m_current[key] = time_us;
+}
+
+void CompileHistory::keep(const std::string& key) {
+    auto it = m_previous.find(key);
+    if (it != m_previous.end()) m_current.try_emplace(key, it->second);
+}
+
+std::string CompileHistory::make_key(const std::string& shader_path, uint32_t stage, const std::vector<std::pair<std::string, std::string>>& definitions) {
+    std::string key = shader_path + ':' + std::to_string(stage);
+    for (auto& [name, value] : definitions) {
+        key += ' ';
+        key += name;
+        key += '=';
+        key += value;
+    }
+
+    return key;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Remembers how long each (shader, stage, definitions) job took to compile on the previous run
+// so that the most expensive jobs can be started first.
+class CompileHistory {
+public:
+    // starts a new run, the times recorded so far are forgotten
+    void load(const char* file_name);
+    bool save(const char* file_name) const;
+
+    // Returns the last recorded compile time in microseconds, or estimated_us if the job was never seen
+    uint64_t predict(const std::string& key, uint64_t estimated_us) const;
+    void record(const std::string& key, uint64_t time_us);
+    // the job was reused instead of compiled this run, its previous time is saved again
+    void keep(const std::string& key);
+
+    // the stage tells apart the stages of a file that holds several
+    static std::string make_key(const std::string& shader_path, uint32_t stage, const std::vector<std::pair<std::string, std::string>>& definitions);
+
+private:
+    std::unordered_map<std::string, uint64_t> m_previous;
+    std::unordered_map<std::string, uint64_t> m_current;
+};
@@ -0,0 +1,37 @@
+#include "compile_memo.hpp"
+
+bool CompileMemo::acquire(const Hash& key, std::vector<uint32_t>& out_spv, std::string& out_error) {
+    std::unique_lock lock(m_mutex);
+
+    auto [it, inserted] = m_entries.try_emplace(key);
+    if (inserted) {
+        it->second = std::make_shared<Entry>();
+        return false;
+    }
+
+    std::shared_ptr<Entry> entry = it->second;
+    m_done_cv.wait(lock, [&] { return entry->done; });
+
+    out_spv   = entry->spv;
+    out_error = entry->error;
+    m_reused++;
+    return true;
+}
+
+void CompileMemo::publish(const Hash& key, const std::vector<uint32_t>& spv, const std::string& error) {
+    {
+        std::lock_guard lock(m_mutex);
+
+        Entry& entry = *m_entries.at(key);
+        entry.spv    = spv;
+        entry.error  = error;
+        entry.done   = true;
+    }
+    m_done_cv.notify_all();
+}
+
+void CompileMemo::clear() {
+    std::lock_guard lock(m_mutex);
+    m_entries.clear();
+    m_reused = 0;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "hash.hpp"
+
+// Results of the compiles of one build keyed by what determines them. A request for a key that is
+// already being compiled waits for that compile instead of starting its own.
+class CompileMemo {
+public:
+    // True if the key was compiled or is being compiled, out_spv and out_error are then set once it is done.
+    // Otherwise the caller has to compile it and call publish, even if the compile failed.
+    bool acquire(const Hash& key, std::vector<uint32_t>& out_spv, std::string& out_error);
+    void publish(const Hash& key, const std::vector<uint32_t>& spv, const std::string& error);
+
+    // number of acquire calls that were answered without compiling
+    size_t reused() const { return m_reused; }
+
+    // not while a build is running
+    void clear();
+
+private:
+    struct Entry {
+        bool done = false;
+        std::vector<uint32_t> spv;
+        std::string error;
+    };
+
+    std::mutex m_mutex;
+    std::condition_variable m_done_cv;
+    std::unordered_map<Hash, std::shared_ptr<Entry>, HashHasher> m_entries;
+    std::atomic<size_t> m_reused = 0;
+};
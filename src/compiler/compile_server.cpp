@@ -0,0 +1,188 @@
+#include "compile_server.hpp"
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "socket_io.hpp"
+
+// protocol: a u32 count of descriptors followed by them as SCM_RIGHTS: the client's stdout and stderr and, if it has
+// one, the read and write end of its jobserver. Then the request, starting with PROTOCOL_VERSION. The server answers
+// STATUS_ACCEPTED followed by the exit code as a u32 once the build is done, or STATUS_REFUSED.
+const uint32_t PROTOCOL_VERSION = 1;
+
+enum RequestStatus : uint32_t {
+    STATUS_ACCEPTED = 0,
+    STATUS_REFUSED  = 1,
+};
+
+// a client that stalls while sending its request must not hold up the ones after it, the build itself isn't bounded
+const int REQUEST_TIMEOUT_MS = 5000;
+
+// far beyond any path or option list, protects against a broken client
+const uint32_t MAX_STRING_SIZE  = 1 << 20;
+const uint32_t MAX_STRING_COUNT = 1 << 16;
+
+static bool write_string(int socket, std::string_view str) {
+    return write_u32(socket, str.size()) && write_str(socket, str);
+}
+
+static bool read_string(int socket, std::string& str) {
+    uint32_t size;
+    return read_u32(socket, size) && size <= MAX_STRING_SIZE && read_str(socket, str, size);
+}
+
+static bool write_strings(int socket, const std::vector<std::string>& strings) {
+    if (!write_u32(socket, strings.size())) return false;
+    for (auto& str : strings) {
+        if (!write_string(socket, str)) return false;
+    }
+    return true;
+}
+
+static bool read_strings(int socket, std::vector<std::string>& strings) {
+    uint32_t count;
+    if (!read_u32(socket, count) || count > MAX_STRING_COUNT) return false;
+
+    strings.resize(count);
+    for (auto& str : strings) {
+        if (!read_string(socket, str)) return false;
+    }
+    return true;
+}
+
+static bool write_request(int socket, const BuildRequest& request) {
+    return write_u32(socket, PROTOCOL_VERSION) && write_string(socket, request.working_directory) && write_strings(socket, request.material_files) &&
+           write_string(socket, request.output_file) && write_strings(socket, request.include_dirs) && write_u32(socket, request.incremental) &&
+           write_u32(socket, request.shard_index) && write_u32(socket, request.shard_count) && write_u32(socket, request.write_dependencies) &&
+           write_string(socket, request.depfile) && write_u32(socket, request.print_cache_stats) && write_string(socket, request.options);
+}
+
+static bool read_request(int socket, BuildRequest& request) {
+    uint32_t version, incremental, write_dependencies, print_cache_stats;
+    bool ok = read_u32(socket, version) && version == PROTOCOL_VERSION && read_string(socket, request.working_directory) &&
+              read_strings(socket, request.material_files) && read_string(socket, request.output_file) && read_strings(socket, request.include_dirs) &&
+              read_u32(socket, incremental) && read_u32(socket, request.shard_index) && read_u32(socket, request.shard_count) &&
+              read_u32(socket, write_dependencies) && read_string(socket, request.depfile) && read_u32(socket, print_cache_stats) &&
+              read_string(socket, request.options);
+    if (!ok) return false;
+
+    request.incremental        = incremental;
+    request.write_dependencies = write_dependencies;
+    request.print_cache_stats  = print_cache_stats;
+    return request.shard_index < request.shard_count && request.working_directory.starts_with('/');
+}
+
+std::string default_server_socket() {
+    if (const char* path = getenv("SHADER_COMPILER_SOCKET")) return path;
+
+    const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (runtime_dir && runtime_dir[0] == '/') return std::string(runtime_dir) + "/shader_compiler.sock";
+
+    // anyone can create files in /tmp, the directory has to be ours and closed to everyone else
+    std::string dir = "/tmp/shader_compiler-" + std::to_string(getuid());
+    mkdir(dir.c_str(), 0700);
+
+    struct stat st;
+    if (lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077) != 0) return "";
+
+    return dir + "/server.sock";
+}
+
+bool run_on_server(const char* socket_path, const BuildRequest& request, int& out_exit_code) {
+    int socket = connect_unix_socket(socket_path);
+    if (socket < 0) return false;
+
+    // our output and files only go to a server of our own user
+    if (!peer_is_same_user(socket)) {
+        fprintf(stderr, "the compile server at %s belongs to another user, compiling in this process\n", socket_path);
+        close(socket);
+        return false;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    // the server takes its jobs from our budget
+    auto jobserver       = JobServerClient::from_environment();
+    std::vector<int> fds = {STDOUT_FILENO, STDERR_FILENO};
+    if (jobserver) {
+        fds.push_back(jobserver->read_fd());
+        fds.push_back(jobserver->write_fd());
+    }
+
+    uint32_t status, exit_code = 1;
+    bool ok = write_u32(socket, fds.size()) && send_fds(socket, fds.data(), fds.size()) && write_request(socket, request) && read_u32(socket, status) &&
+              (status != STATUS_ACCEPTED || read_u32(socket, exit_code));
+    close(socket);
+
+    // a server that went away before answering may not have built anything
+    if (!ok) {
+        fprintf(stderr, "lost the connection to the compile server, compiling in this process\n");
+        return false;
+    }
+    if (status != STATUS_ACCEPTED) {
+        fprintf(stderr, "the compile server at %s was started with other options, compiling in this process\n", socket_path);
+        return false;
+    }
+
+    out_exit_code = exit_code;
+    return true;
+}
+
+static void serve_request(int socket, const std::string& options, const std::function<bool(const BuildRequest&, ServedClient&)>& build) {
+    uint32_t fd_count;
+    int client_fds[4];
+    if (!read_u32(socket, fd_count) || (fd_count != 2 && fd_count != 4) || !recv_fds(socket, client_fds, fd_count)) return;
+
+    BuildRequest request;
+    if (!read_request(socket, request) || request.options != options) {
+        for (uint32_t i = 0; i < fd_count; ++i) close(client_fds[i]);
+        write_u32(socket, STATUS_REFUSED);
+        return;
+    }
+
+    ServedClient client{
+        .out       = fdopen(client_fds[0], "w"),
+        .err       = fdopen(client_fds[1], "w"),
+        .jobserver = fd_count == 4 ? JobServerClient::from_fds(client_fds[2], client_fds[3]) : nullptr,
+    };
+
+    int exit_code = 1;
+    if (client.out && client.err) {
+        exit_code = build(request, client) ? 0 : 1;
+    }
+
+    // closing them is what the client waits for if it reads its output through a pipe
+    if (client.out) fclose(client.out); else close(client_fds[0]);
+    if (client.err) fclose(client.err); else close(client_fds[1]);
+    client.jobserver = nullptr;
+
+    write_u32(socket, STATUS_ACCEPTED) && write_u32(socket, exit_code);
+}
+
+int run_compile_server(const char* socket_path, const std::string& options, const std::function<bool(const BuildRequest&, ServedClient&)>& build) {
+    int listen_socket = listen_unix_socket(socket_path);
+    if (listen_socket < 0) {
+        fprintf(stderr, "failed to listen on %s, is another compile server running?\n", socket_path);
+        return 1;
+    }
+
+    // a client that disappears mid build must not take the server down with it
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("compile server listening on %s\n", socket_path);
+    fflush(stdout);
+
+    while (true) {
+        int socket = accept(listen_socket, nullptr, nullptr);
+        if (socket < 0) continue;
+
+        if (peer_is_same_user(socket) && set_socket_timeout(socket, REQUEST_TIMEOUT_MS)) serve_request(socket, options, build);
+
+        close(socket);
+    }
+}
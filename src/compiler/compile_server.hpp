@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "jobserver.hpp"
+
+// Everything about a build that can differ between the invocations one compile server handles.
+// Relative paths are relative to working_directory.
+struct BuildRequest {
+    std::string working_directory;
+    std::vector<std::string> material_files;
+    std::string output_file;
+    std::vector<std::string> include_dirs;
+    bool incremental        = true;
+    uint32_t shard_index    = 0;
+    uint32_t shard_count    = 1;
+    bool write_dependencies = false;
+    std::string depfile; // empty for the default
+    bool print_cache_stats = false;
+    // describes everything else the build depends on, like the compiler settings and caches,
+    // a server only takes the requests of clients that were started with the same as itself
+    std::string options;
+};
+
+// Where a build the server runs for a client reports to, and the client's jobserver if it has one.
+struct ServedClient {
+    FILE* out;
+    FILE* err;
+    std::unique_ptr<JobServerClient> jobserver;
+};
+
+// $SHADER_COMPILER_SOCKET, or a socket in $XDG_RUNTIME_DIR or in a private per user directory in /tmp.
+// Empty if that directory exists but can't be trusted.
+std::string default_server_socket();
+
+// Hands the build to the compile server listening on socket_path, its output goes to our stdout and stderr.
+// False if there is no server of our user or it was started with other options, the build has to run in this process then.
+bool run_on_server(const char* socket_path, const BuildRequest& request, int& out_exit_code);
+
+// Serves the build requests with the given options one at a time until the process is killed. Only processes of
+// our own user are served. The server's working directory and stdio are left alone, build has to resolve the paths
+// of the request against its working directory and write to the client's streams.
+int run_compile_server(const char* socket_path, const std::string& options, const std::function<bool(const BuildRequest&, ServedClient&)>& build);
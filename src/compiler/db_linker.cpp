@@ -0,0 +1,140 @@
+#include "db_linker.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <file_header.hpp>
+
+namespace fs = std::filesystem;
+
+// copies the records of one database and collects its variants, returns false if it is malformed or defines a name again
+static bool link_file(const char* input_file, std::ofstream& output, uint32_t& shader_count, std::vector<PipelineVariant>& variants,
+                      std::unordered_map<std::string, const char*>& defined_in) {
+    std::ifstream input(input_file, std::ios::binary | std::ios::ate);
+    if (!input.is_open()) {
+        fprintf(stderr, "failed to open shader database: %s\n", input_file);
+        return false;
+    }
+
+    // every size read from the file is checked against it before anything is allocated for it
+    uint64_t file_size = input.tellg();
+    input.seekg(0);
+
+    ShaderDBHeader header;
+    if (!input.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != SHADER_DB_MAGIC) {
+        fprintf(stderr, "not a shader database: %s\n", input_file);
+        return false;
+    }
+    if (header.version != SHADER_DB_VERSION) {
+        fprintf(stderr, "shader database %s has version %u, expected %u\n", input_file, header.version, SHADER_DB_VERSION);
+        return false;
+    }
+
+    // where the records of this input start in the output
+    uint32_t output_start = output.tellp();
+
+    // one record at a time so the inputs never have to fit in memory
+    std::vector<char> record;
+    for (uint32_t i = 0; i < header.shader_count; ++i) {
+        uint32_t total_size;
+        if (!input.read(reinterpret_cast<char*>(&total_size), sizeof(total_size)) || total_size < sizeof(CompiledPipeline) ||
+            total_size - sizeof(total_size) > file_size - uint64_t(input.tellg())) {
+            fprintf(stderr, "truncated shader database: %s\n", input_file);
+            return false;
+        }
+
+        record.resize(total_size);
+        memcpy(record.data(), &total_size, sizeof(total_size));
+        if (!input.read(record.data() + sizeof(total_size), total_size - sizeof(total_size))) {
+            fprintf(stderr, "truncated shader database: %s\n", input_file);
+            return false;
+        }
+
+        auto* pipeline = reinterpret_cast<const CompiledPipeline*>(record.data());
+        std::string name(pipeline->shader_name, strnlen(pipeline->shader_name, sizeof(pipeline->shader_name)));
+
+        auto [it, inserted] = defined_in.emplace(name, input_file);
+        if (!inserted) {
+            fprintf(stderr, "pipeline %s is defined in both %s and %s\n", name.c_str(), it->second, input_file);
+            return false;
+        }
+
+        output.write(record.data(), record.size());
+        shader_count++;
+    }
+
+    uint32_t records_end = input.tellg();
+    if (header.variant_count > 0) {
+        if (header.variant_table_offset > file_size || header.variant_count > (file_size - header.variant_table_offset) / sizeof(PipelineVariant)) {
+            fprintf(stderr, "truncated shader database: %s\n", input_file);
+            return false;
+        }
+
+        size_t first = variants.size();
+        variants.resize(first + header.variant_count);
+
+        if (!input.seekg(header.variant_table_offset) || !input.read(reinterpret_cast<char*>(&variants[first]), header.variant_count * sizeof(PipelineVariant))) {
+            fprintf(stderr, "truncated shader database: %s\n", input_file);
+            return false;
+        }
+
+        // the records are copied as they are, only their position changes
+        for (size_t i = first; i < variants.size(); ++i) {
+            if (variants[i].pipeline_offset < sizeof(ShaderDBHeader) || variants[i].pipeline_offset >= records_end) {
+                fprintf(stderr, "invalid variant table in shader database: %s\n", input_file);
+                return false;
+            }
+            variants[i].pipeline_offset = variants[i].pipeline_offset - sizeof(ShaderDBHeader) + output_start;
+        }
+    }
+
+    return true;
+}
+
+int run_linker(const char* output_file, std::span<const char* const> input_files) {
+    std::string tmp_file = std::string(output_file) + ".tmp";
+
+    std::ofstream output(tmp_file, std::ios::out | std::ios::binary);
+    if (!output.is_open()) {
+        fprintf(stderr, "failed to open output file: %s\n", tmp_file.c_str());
+        return 1;
+    }
+
+    ShaderDBHeader header{};
+    header.magic   = SHADER_DB_MAGIC;
+    header.version = SHADER_DB_VERSION;
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<PipelineVariant> variants;
+    std::unordered_map<std::string, const char*> defined_in;
+    for (const char* input_file : input_files) {
+        if (!link_file(input_file, output, header.shader_count, variants, defined_in)) {
+            output.close();
+            fs::remove(tmp_file);
+            return 1;
+        }
+    }
+
+    header.variant_count        = variants.size();
+    header.variant_table_offset = output.tellp();
+    output.write(reinterpret_cast<const char*>(variants.data()), variants.size() * sizeof(PipelineVariant));
+
+    header.total_size = output.tellp();
+    output.seekp(0);
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    output.close();
+
+    std::error_code ec;
+    if (output.fail() || (fs::rename(tmp_file, output_file, ec), ec)) {
+        fprintf(stderr, "failed to write output file: %s\n", output_file);
+        return 1;
+    }
+
+    printf("linked %u pipelines from %zu databases\n", header.shader_count, input_files.size());
+    return 0;
+}
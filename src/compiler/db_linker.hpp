@@ -0,0 +1,7 @@
+#pragma once
+
+#include <span>
+
+// Merges shader databases, for example the shards of a --shard build, into one without recompiling anything.
+// The pipelines are copied in the order of the inputs, a name defined by two inputs is an error.
+int run_linker(const char* output_file, std::span<const char* const> input_files);
@@ -0,0 +1,43 @@
+#include "depfile.hpp"
+
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+static void write_escaped(std::ofstream& file, const std::string& path, const std::string& working_directory) {
+    std::error_code ec;
+    fs::path absolute = fs::absolute(fs::path(working_directory) / path, ec);
+    std::string escaped = ec ? path : absolute.lexically_normal().native();
+
+    for (char c : escaped) {
+        if (c == ' ' || c == '#' || c == '\\') file << '\\';
+        if (c == '$') file << '$';
+        file << c;
+    }
+}
+
+bool write_depfile(const char* file_name, const char* target, const std::vector<std::string>& dependencies, const std::string& working_directory) {
+    fs::path path        = fs::path(working_directory) / file_name;
+    std::string tmp_name = path.native() + ".tmp";
+
+    {
+        std::ofstream file(tmp_name, std::ios::out | std::ios::trunc);
+        if (!file.is_open()) return false;
+
+        write_escaped(file, target, working_directory);
+        file << ':';
+        for (auto& dependency : dependencies) {
+            file << " \\\n  ";
+            write_escaped(file, dependency, working_directory);
+        }
+        file << '\n';
+
+        if (file.fail()) return false;
+    }
+
+    // the build tool never sees half a file
+    std::error_code ec;
+    fs::rename(tmp_name, path, ec);
+    return !ec;
+}
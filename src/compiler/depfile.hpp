@@ -0,0 +1,9 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Writes a Makefile style "target: dependencies" rule like gcc -MD -MF, understood by make, ninja and CMake's DEPFILE.
+// The paths are made absolute since the build tool may read the file from another directory, relative ones
+// including file_name are taken relative to working_directory, or the process's working directory if that is empty.
+bool write_depfile(const char* file_name, const char* target, const std::vector<std::string>& dependencies, const std::string& working_directory = "");
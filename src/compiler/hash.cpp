@@ -0,0 +1,145 @@
+#include "hash.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+static const uint32_t ROUND_CONSTANTS[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+Hasher::Hasher() {
+    const uint32_t initial_state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(m_state, initial_state, sizeof(m_state));
+}
+
+void Hasher::update(const void* data, size_t size) {
+    auto* bytes = reinterpret_cast<const uint8_t*>(data);
+    m_total_size += size;
+
+    if (m_block_size > 0) {
+        size_t count = std::min(size, sizeof(m_block) - m_block_size);
+        memcpy(m_block + m_block_size, bytes, count);
+        m_block_size += count;
+        bytes += count;
+        size -= count;
+
+        if (m_block_size < sizeof(m_block)) return;
+
+        process_block(m_block);
+        m_block_size = 0;
+    }
+
+    for (; size >= sizeof(m_block); bytes += sizeof(m_block), size -= sizeof(m_block)) {
+        process_block(bytes);
+    }
+
+    memcpy(m_block, bytes, size);
+    m_block_size = size;
+}
+
+Hash Hasher::finish() {
+    uint64_t bit_size = m_total_size * 8;
+
+    uint8_t padding[72] = {0x80};
+    size_t padding_size = (m_block_size < 56 ? 56 : 120) - m_block_size;
+    for (int i = 0; i < 8; ++i) {
+        padding[padding_size + i] = bit_size >> (56 - i * 8);
+    }
+    update(padding, padding_size + 8);
+
+    Hash hash;
+    for (int i = 0; i < 8; ++i) {
+        hash[i * 4 + 0] = m_state[i] >> 24;
+        hash[i * 4 + 1] = m_state[i] >> 16;
+        hash[i * 4 + 2] = m_state[i] >> 8;
+        hash[i * 4 + 3] = m_state[i];
+    }
+    return hash;
+}
+
+void Hasher::process_block(const uint8_t* block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = (block[i * 4] << 24) | (block[i * 4 + 1] << 16) | (block[i * 4 + 2] << 8) | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i]        = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+    uint32_t e = m_state[4], f = m_state[5], g = m_state[6], h = m_state[7];
+
+    for (int i = 0; i < 64; ++i) {
+        uint32_t s1    = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+        uint32_t ch    = (e & f) ^ (~e & g);
+        uint32_t temp1 = h + s1 + ch + ROUND_CONSTANTS[i] + w[i];
+        uint32_t s0    = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+        uint32_t maj   = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t temp2 = s0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + temp1;
+        d = c;
+        c = b;
+        b = a;
+        a = temp1 + temp2;
+    }
+
+    m_state[0] += a;
+    m_state[1] += b;
+    m_state[2] += c;
+    m_state[3] += d;
+    m_state[4] += e;
+    m_state[5] += f;
+    m_state[6] += g;
+    m_state[7] += h;
+}
+
+Hash hash_data(std::string_view data) {
+    Hasher hasher;
+    hasher.update(data);
+    return hasher.finish();
+}
+
+std::string to_hex(const Hash& hash) {
+    const char* digits = "0123456789abcdef";
+
+    std::string hex;
+    hex.reserve(hash.size() * 2);
+    for (uint8_t byte : hash) {
+        hex += digits[byte >> 4];
+        hex += digits[byte & 0xf];
+    }
+    return hex;
+}
+
+bool from_hex(std::string_view hex, Hash& out_hash) {
+    if (hex.size() != out_hash.size() * 2) return false;
+
+    auto digit = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        return -1;
+    };
+
+    for (size_t i = 0; i < out_hash.size(); ++i) {
+        int high = digit(hex[i * 2]), low = digit(hex[i * 2 + 1]);
+        if (high < 0 || low < 0) return false;
+
+        out_hash[i] = high << 4 | low;
+    }
+    return true;
+}
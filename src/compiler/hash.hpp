@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+using Hash = std::array<uint8_t, 32>;
+
+// SHA-256, strong enough to use as a content address for cached compile results
+class Hasher {
+public:
+    Hasher();
+
+    void update(const void* data, size_t size);
+    void update(std::string_view str) { update(str.data(), str.size()); }
+    void update_u64(uint64_t value) { update(&value, sizeof(value)); }
+
+    // length prefixed so that consecutive strings can't be confused with each other ("ab" "c" vs "a" "bc")
+    void update_str(std::string_view str) {
+        update_u64(str.size());
+        update(str);
+    }
+
+    Hash finish();
+
+private:
+    void process_block(const uint8_t* block);
+
+private:
+    uint32_t m_state[8];
+    uint8_t m_block[64];
+    size_t m_block_size = 0;
+    uint64_t m_total_size = 0;
+};
+
+Hash hash_data(std::string_view data);
+
+// for unordered containers, the hash is already uniformly distributed
+struct HashHasher {
+    size_t operator()(const Hash& hash) const {
+        size_t bits;
+        memcpy(&bits, hash.data(), sizeof(bits));
+        return bits;
+    }
+};
+
+std::string to_hex(const Hash& hash);
+bool from_hex(std::string_view hex, Hash& out_hash);
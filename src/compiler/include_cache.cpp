@@ -0,0 +1,357 @@
+#include "include_cache.hpp"
+
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <mutex>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unordered_set>
+#include <unistd.h>
+#include <vector>
+
+#include "shm_cache.hpp"
+
+namespace fs = std::filesystem;
+
+CachedInclude::~CachedInclude() {
+    if (mapping) munmap(mapping, mapped_size);
+}
+
+IncludeCache& IncludeCache::process_cache() {
+    static IncludeCache cache;
+    return cache;
+}
+
+// include files are shared between compiler processes, keyed by everything stat knows about them
+static Hash shared_key(const std::string& path, const struct stat& st) {
+    Hasher hasher;
+    hasher.update_str("include");
+    hasher.update_str(path);
+    hasher.update_u64(st.st_ino);
+    hasher.update_u64(st.st_size);
+    hasher.update_u64(st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec);
+    return hasher.finish();
+}
+
+static bool is_identifier_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static std::string_view trim(std::string_view text) {
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t' || text.front() == '\r')) text.remove_prefix(1);
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t' || text.back() == '\r')) text.remove_suffix(1);
+    return text;
+}
+
+static std::string_view take_identifier(std::string_view& text) {
+    text = trim(text);
+    size_t length = 0;
+    while (length < text.size() && is_identifier_char(text[length])) length++;
+
+    std::string_view identifier = text.substr(0, length);
+    text.remove_prefix(length);
+    return identifier;
+}
+
+// the macro tested by "#ifndef X", "#if !defined X" or "#if !defined(X)", empty for anything else
+static std::string_view guard_condition(std::string_view directive, std::string_view arguments) {
+    if (directive == "ifndef") {
+        std::string_view macro = take_identifier(arguments);
+        return trim(arguments).empty() ? macro : std::string_view();
+    }
+    if (directive != "if") return {};
+
+    arguments = trim(arguments);
+    if (!arguments.starts_with('!')) return {};
+    arguments.remove_prefix(1);
+
+    if (take_identifier(arguments) != "defined") return {};
+
+    arguments        = trim(arguments);
+    bool parentheses = arguments.starts_with('(');
+    if (parentheses) arguments.remove_prefix(1);
+
+    std::string_view macro = take_identifier(arguments);
+    arguments              = trim(arguments);
+    if (parentheses) {
+        if (!arguments.starts_with(')')) return {};
+        arguments.remove_prefix(1);
+    }
+    return trim(arguments).empty() ? macro : std::string_view();
+}
+
+IncludeGuardInfo analyze_include_guard(std::string_view content) {
+    enum GuardState {
+        EXPECT_IF,
+        EXPECT_DEFINE,
+        INSIDE,
+        AFTER_ENDIF,
+        NO_GUARD,
+    };
+
+    IncludeGuardInfo info;
+    GuardState state = EXPECT_IF;
+    std::string guard;
+    int depth             = 0;
+    int conditional_depth = 0; // of every #if, a #pragma once inside one may not be reached
+
+    bool in_block_comment = false;
+    size_t pos            = 0;
+    while (pos < content.size()) {
+        size_t end = content.find('\n', pos);
+        if (end == std::string_view::npos) end = content.size();
+
+        // strip the comments, a directive continued over several lines only has its first line looked at
+        std::string line;
+        for (size_t i = pos; i < end; ++i) {
+            if (in_block_comment) {
+                if (content[i] == '*' && i + 1 < end && content[i + 1] == '/') {
+                    in_block_comment = false;
+                    i++;
+                }
+                continue;
+            }
+            if (content[i] == '/' && i + 1 < end && content[i + 1] == '/') break;
+            if (content[i] == '/' && i + 1 < end && content[i + 1] == '*') {
+                in_block_comment = true;
+                line += ' ';
+                i++;
+                continue;
+            }
+            line += content[i];
+        }
+        pos = end + 1;
+
+        std::string_view text = trim(line);
+        if (text.empty()) continue;
+
+        if (!text.starts_with('#')) {
+            if (state != INSIDE) state = NO_GUARD;
+            continue;
+        }
+
+        text.remove_prefix(1);
+        std::string_view directive = take_identifier(text);
+
+        if (directive == "undef") info.undefined_macros.emplace_back(take_identifier(text));
+        if (directive == "pragma" && take_identifier(text) == "once" && conditional_depth == 0) info.pragma_once = true;
+        if (directive.starts_with("if")) conditional_depth++;
+        if (directive == "endif" && conditional_depth > 0) conditional_depth--;
+
+        switch (state) {
+        case EXPECT_IF:
+            guard = guard_condition(directive, text);
+            state = guard.empty() ? NO_GUARD : EXPECT_DEFINE;
+            break;
+        case EXPECT_DEFINE:
+            state = directive == "define" && take_identifier(text) == guard ? INSIDE : NO_GUARD;
+            break;
+        case INSIDE:
+            if (directive.starts_with("if")) {
+                depth++;
+            } else if (directive == "endif") {
+                if (depth == 0) state = AFTER_ENDIF;
+                else depth--;
+            } else if (depth == 0 && (directive == "else" || directive.starts_with("elif"))) {
+                state = NO_GUARD;
+            }
+            break;
+        case AFTER_ENDIF:
+            state = NO_GUARD;
+            break;
+        case NO_GUARD:
+            break;
+        }
+    }
+
+    if (state == AFTER_ENDIF) info.guard_macro = std::move(guard);
+    return info;
+}
+
+std::shared_ptr<const CachedInclude> IncludeCache::get(const std::string& path, SharedMemoryCache* shared_cache) {
+    {
+        std::shared_lock lock(m_mutex);
+        if (auto it = m_by_path.find(path); it != m_by_path.end()) return it->second;
+    }
+
+    std::error_code ec;
+    std::string canonical_path = fs::canonical(in_working_directory(path), ec).native();
+    if (ec) {
+        throw std::runtime_error("failed to open file: " + path);
+    }
+
+    {
+        std::unique_lock lock(m_mutex);
+        if (auto it = m_by_canonical_path.find(canonical_path); it != m_by_canonical_path.end()) {
+            m_by_path.emplace(path, it->second);
+            return it->second;
+        }
+    }
+
+    // loaded without the lock, if another thread gets there first its copy wins
+    auto file = load(canonical_path, shared_cache);
+
+    std::unique_lock lock(m_mutex);
+    auto [it, inserted] = m_by_canonical_path.emplace(canonical_path, std::move(file));
+    m_by_path.emplace(path, it->second);
+    return it->second;
+}
+
+void IncludeCache::invalidate(const std::vector<std::string>& paths) {
+    std::unordered_set<std::string> canonical_paths;
+    for (auto& path : paths) {
+        std::error_code ec;
+        canonical_paths.insert(fs::weakly_canonical(in_working_directory(path), ec).native());
+    }
+
+    std::unique_lock lock(m_mutex);
+    std::erase_if(m_by_canonical_path, [&](auto& entry) { return canonical_paths.contains(entry.first); });
+    std::erase_if(m_by_path, [&](auto& entry) { return canonical_paths.contains(entry.second->canonical_path); });
+    m_lookups.clear();
+}
+
+void IncludeCache::revalidate() {
+    std::unique_lock lock(m_mutex);
+
+    std::erase_if(m_by_canonical_path, [](auto& entry) {
+        const CachedInclude& file = *entry.second;
+
+        struct stat st;
+        return stat(file.canonical_path.c_str(), &st) != 0 || st.st_ino != file.inode || uint64_t(st.st_size) != file.size ||
+               st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec != file.mtime_ns;
+    });
+
+    // relative paths may mean other files now
+    m_by_path.clear();
+    m_lookups.clear();
+}
+
+void IncludeCache::set_include_dirs(std::vector<std::string> include_dirs) {
+    std::unique_lock lock(m_mutex);
+    m_include_dirs = std::move(include_dirs);
+    m_lookups.clear();
+}
+
+void IncludeCache::set_working_directory(std::string working_directory) {
+    std::unique_lock lock(m_mutex);
+    if (working_directory == m_working_directory) return;
+
+    // the same relative paths mean other files now
+    m_working_directory = std::move(working_directory);
+    m_by_path.clear();
+    m_lookups.clear();
+}
+
+std::string IncludeCache::in_working_directory(const std::string& path) const {
+    return m_working_directory.empty() || path.starts_with('/') ? path : m_working_directory + '/' + path;
+}
+
+bool IncludeCache::is_regular_file(const std::string& path) const {
+    struct stat st;
+    return stat(in_working_directory(path).c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+bool IncludeCache::resolve(std::string_view requesting_source, std::string_view name, bool relative, std::string& out_path) {
+    // only the directory of the including file matters for relative lookups
+    std::string_view requesting_dir;
+    if (relative) {
+        size_t slash   = requesting_source.rfind('/');
+        requesting_dir = slash == std::string_view::npos ? std::string_view() : requesting_source.substr(0, slash + 1);
+    }
+
+    std::string key;
+    key.reserve(requesting_dir.size() + name.size() + 2);
+    key += relative ? '"' : '<';
+    key += requesting_dir;
+    key += '\0';
+    key += name;
+
+    {
+        std::shared_lock lock(m_mutex);
+        if (auto it = m_lookups.find(key); it != m_lookups.end()) {
+            out_path = it->second;
+            return !out_path.empty();
+        }
+    }
+
+    std::string path;
+    if (name.starts_with('/')) {
+        if (is_regular_file(std::string(name))) path = name;
+    } else {
+        if (relative && is_regular_file(std::string(requesting_dir) + std::string(name))) {
+            path = std::string(requesting_dir) + std::string(name);
+        }
+
+        for (size_t i = 0; path.empty() && i < m_include_dirs.size(); ++i) {
+            std::string candidate = (fs::path(m_include_dirs[i]) / name).native();
+            if (is_regular_file(candidate)) path = std::move(candidate);
+        }
+    }
+
+    std::unique_lock lock(m_mutex);
+    m_lookups.emplace(std::move(key), path);
+
+    out_path = std::move(path);
+    return !out_path.empty();
+}
+
+std::shared_ptr<const CachedInclude> IncludeCache::load(const std::string& canonical_path, SharedMemoryCache* shared_cache) {
+    int fd = open(canonical_path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        throw std::runtime_error("failed to open file: " + canonical_path);
+    }
+
+    auto file            = std::make_shared<CachedInclude>();
+    file->canonical_path = canonical_path;
+    file->inode          = st.st_ino;
+    file->size           = st.st_size;
+    file->mtime_ns       = st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+
+    Hash key = shared_key(canonical_path, st);
+
+    // stored as content hash followed by the content
+    std::vector<char> value;
+    if (shared_cache && shared_cache->get(key, value) && value.size() >= sizeof(Hash)) {
+        close(fd);
+
+        memcpy(file->content_hash.data(), value.data(), sizeof(Hash));
+        file->storage.assign(value.data() + sizeof(Hash), value.size() - sizeof(Hash));
+        file->content = file->storage;
+        file->guard   = analyze_include_guard(file->content);
+        return file;
+    }
+
+    void* mapping = m_map_files && st.st_size > 0 ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if (mapping != MAP_FAILED) {
+        file->mapping     = mapping;
+        file->mapped_size = st.st_size;
+        file->content     = std::string_view(static_cast<const char*>(mapping), st.st_size);
+    } else {
+        // empty files, ones that can't be mapped, like pipes, and every file if mapping is off
+        file->storage.reserve(st.st_size);
+
+        char buffer[16384];
+        ssize_t count;
+        while ((count = read(fd, buffer, sizeof(buffer))) > 0) {
+            file->storage.append(buffer, count);
+        }
+        file->content = file->storage;
+    }
+    close(fd);
+
+    file->content_hash = hash_data(file->content);
+    file->guard        = analyze_include_guard(file->content);
+
+    if (shared_cache) {
+        std::string stored(reinterpret_cast<const char*>(file->content_hash.data()), sizeof(Hash));
+        stored += file->content;
+        shared_cache->put(key, stored);
+    }
+
+    return file;
+}
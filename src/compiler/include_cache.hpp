@@ -0,0 +1,91 @@
+#pragma once
+
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "hash.hpp"
+
+class SharedMemoryCache;
+
+// What the preprocessor needs to know to skip a file it has already included.
+struct IncludeGuardInfo {
+    std::string guard_macro; // set if the whole file is wrapped in #ifndef guard_macro / #define guard_macro / #endif
+    bool pragma_once = false; // only outside of any #if, where it is always reached
+    std::vector<std::string> undefined_macros; // every #undef, a guard that was undefined has to be read again
+};
+
+// a cheap scan over the directives, like GCC's multiple include optimization
+IncludeGuardInfo analyze_include_guard(std::string_view content);
+
+// Immutable contents of an include file, mapped straight from the file where possible.
+struct CachedInclude {
+    std::string canonical_path;
+    std::string_view content;
+    Hash content_hash;
+    IncludeGuardInfo guard;
+
+    // what the file looked like when it was read
+    uint64_t inode;
+    uint64_t size;
+    uint64_t mtime_ns;
+
+    ~CachedInclude();
+
+    void* mapping       = nullptr;
+    size_t mapped_size  = 0;
+    std::string storage; // holds the content if it wasn't mapped
+};
+
+// Include files read by any compilation in this process, so every file is only opened once per build.
+// Files are assumed not to change unless they are invalidated.
+class IncludeCache {
+public:
+    static IncludeCache& process_cache();
+
+    // throws if the file can't be read, a file read from disk is also added to shared_cache if there is one
+    std::shared_ptr<const CachedInclude> get(const std::string& path, SharedMemoryCache* shared_cache);
+
+    // Finds the file an #include refers to like a C preprocessor would: "name" is looked for next to the
+    // including file first and then like <name> in the include directories, in order.
+    // Every answer, including not finding the file, is remembered so each lookup only touches the disk once.
+    bool resolve(std::string_view requesting_source, std::string_view name, bool relative, std::string& out_path);
+
+    // forgets the files so they are read again, also every lookup since a file may have appeared or disappeared
+    void invalidate(const std::vector<std::string>& paths);
+
+    // drops the files that changed on disk since they were read and forgets every path lookup,
+    // for a process that keeps the cache across builds
+    void revalidate();
+
+    // the directories given with -I, set before any compilation starts
+    void set_include_dirs(std::vector<std::string> include_dirs);
+    const std::vector<std::string>& include_dirs() const { return m_include_dirs; }
+
+    // what relative paths are relative to instead of the process's working directory, empty for that one,
+    // set before any compilation starts
+    void set_working_directory(std::string working_directory);
+    const std::string& working_directory() const { return m_working_directory; }
+    std::string in_working_directory(const std::string& path) const;
+
+    // Off: files are read into memory instead of mapped. Touching a mapped file that was truncated in place raises
+    // SIGBUS, so a process that keeps the cache while the files are edited must not map them.
+    void set_map_files(bool map_files) { m_map_files = map_files; }
+
+private:
+    bool is_regular_file(const std::string& path) const;
+    std::shared_ptr<const CachedInclude> load(const std::string& canonical_path, SharedMemoryCache* shared_cache);
+
+private:
+    std::shared_mutex m_mutex;
+    std::unordered_map<std::string, std::shared_ptr<const CachedInclude>> m_by_path; // as requested, saves resolving the path again
+    std::unordered_map<std::string, std::shared_ptr<const CachedInclude>> m_by_canonical_path;
+
+    std::vector<std::string> m_include_dirs;
+    std::string m_working_directory;
+    bool m_map_files = true;
+    std::unordered_map<std::string, std::string> m_lookups; // "<kind><requesting dir>\0<name>" to the resolved path, empty if there is none
+};
@@ -0,0 +1,97 @@
+#include "include_scanner.hpp"
+
+#include <cstring>
+#include <mutex>
+#include <unordered_set>
+
+#include "include_cache.hpp"
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+void find_include_directives(std::string_view source, std::vector<IncludeDirective>& out_directives) {
+    const char* data = source.data();
+    size_t size      = source.size();
+
+    size_t pos = 0;
+    while (pos < size) {
+        auto* found = static_cast<const char*>(memchr(data + pos, '#', size - pos));
+        if (!found) break;
+
+        size_t hash = found - data;
+        pos         = hash + 1;
+
+        // only blanks may come before it on its line
+        size_t line_start = hash;
+        while (line_start > 0 && is_blank(data[line_start - 1])) line_start--;
+        if (line_start > 0 && data[line_start - 1] != '\n') continue;
+
+        size_t i = pos;
+        while (i < size && is_blank(data[i])) i++;
+        if (source.substr(i, 7) != "include") continue;
+        i += 7;
+        while (i < size && is_blank(data[i])) i++;
+
+        if (i >= size || (data[i] != '"' && data[i] != '<')) continue;
+        char close = data[i] == '"' ? '"' : '>';
+
+        size_t end = source.find_first_of(close == '"' ? "\"\n" : ">\n", i + 1);
+        if (end == std::string_view::npos || data[end] != close) continue;
+
+        out_directives.push_back(IncludeDirective{
+            .name     = std::string(source.substr(i + 1, end - i - 1)),
+            .relative = close == '"',
+        });
+        pos = end + 1;
+    }
+}
+
+std::vector<IncludeDirective> IncludeScanner::directives(const Hash& content_hash, std::string_view content) {
+    {
+        std::shared_lock lock(m_mutex);
+        if (auto it = m_directives.find(content_hash); it != m_directives.end()) return it->second;
+    }
+
+    std::vector<IncludeDirective> found;
+    find_include_directives(content, found);
+
+    std::unique_lock lock(m_mutex);
+    m_directives.emplace(content_hash, found);
+    return found;
+}
+
+StageInputs IncludeScanner::scan(const std::string& shader_path) {
+    IncludeCache& include_cache = IncludeCache::process_cache();
+
+    StageInputs inputs;
+    std::unordered_set<std::string> visited; // canonical paths, a file may be reached under several names
+
+    // depth first so the files come in about the order the preprocessor reads them
+    std::vector<std::pair<std::string, std::shared_ptr<const CachedInclude>>> stack;
+    stack.emplace_back(shader_path, include_cache.get(shader_path, m_shared_cache));
+
+    while (!stack.empty()) {
+        auto [path, file] = std::move(stack.back());
+        stack.pop_back();
+
+        if (!visited.insert(file->canonical_path).second) continue;
+        inputs.emplace_back(path, file->content_hash);
+
+        auto includes = directives(file->content_hash, file->content);
+
+        // pushed in reverse so the first include is scanned first
+        for (auto it = includes.rbegin(); it != includes.rend(); ++it) {
+            std::string include_path;
+            if (!include_cache.resolve(path, it->name, it->relative, include_path)) continue;
+
+            try {
+                stack.emplace_back(include_path, include_cache.get(include_path, m_shared_cache));
+            } catch (const std::exception&) {
+                // gone since it was resolved, the compile reports it if it matters
+            }
+        }
+    }
+
+    return inputs;
+}
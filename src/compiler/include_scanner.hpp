@@ -0,0 +1,46 @@
+#pragma once
+
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "hash.hpp"
+
+class SharedMemoryCache;
+
+// every file a stage read, with the hash of its contents
+using StageInputs = std::vector<std::pair<std::string, Hash>>;
+
+struct IncludeDirective {
+    std::string name;
+    bool relative; // "name" rather than <name>
+};
+
+// every #include at the start of a line, whether or not it is inside an #if or a block comment
+void find_include_directives(std::string_view source, std::vector<IncludeDirective>& out_directives);
+
+// Finds the files a shader depends on without running the preprocessor. Includes are resolved through the
+// IncludeCache like ShadercIncluder does, but conditions aren't evaluated so the result may hold files that
+// the compiler would skip. Thread safe.
+class IncludeScanner {
+public:
+    explicit IncludeScanner(SharedMemoryCache* shared_cache = nullptr) : m_shared_cache(shared_cache) {}
+
+    // The shader followed by everything it includes directly or indirectly, each file once in the order it is
+    // first reached. Includes that can't be found are left out, throws if the shader itself can't be read.
+    StageInputs scan(const std::string& shader_path);
+
+    void set_shared_cache(SharedMemoryCache* shared_cache) { m_shared_cache = shared_cache; }
+
+private:
+    // the directives of a file, by content hash so that it never has to be invalidated
+    std::vector<IncludeDirective> directives(const Hash& content_hash, std::string_view content);
+
+private:
+    SharedMemoryCache* m_shared_cache;
+    std::shared_mutex m_mutex;
+    std::unordered_map<Hash, std::vector<IncludeDirective>, HashHasher> m_directives;
+};
@@ -0,0 +1,150 @@
+#include "jobserver.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <string>
+#include <unistd.h>
+
+static bool is_valid_fd(int fd) {
+    return fd >= 0 && fcntl(fd, F_GETFD) != -1;
+}
+
+static void write_byte(int fd, char byte) {
+    while (write(fd, &byte, 1) < 0 && errno == EINTR) {}
+}
+
+std::string jobserver_auth(std::string_view makeflags) {
+    // older makes use --jobserver-fds, whichever comes last wins
+    size_t last_pos  = std::string_view::npos;
+    size_t value_pos = 0;
+    for (std::string_view option : {"--jobserver-fds=", "--jobserver-auth="}) {
+        size_t pos = makeflags.rfind(option);
+        if (pos == std::string_view::npos || (last_pos != std::string_view::npos && pos < last_pos)) continue;
+
+        last_pos  = pos;
+        value_pos = pos + option.size();
+    }
+    if (last_pos == std::string_view::npos) return "";
+
+    return std::string(makeflags.substr(value_pos, makeflags.find(' ', value_pos) - value_pos));
+}
+
+std::unique_ptr<JobServerClient> JobServerClient::from_environment() {
+    const char* makeflags = getenv("MAKEFLAGS");
+    if (!makeflags) return nullptr;
+
+    std::string auth = jobserver_auth(makeflags);
+    if (auth.empty()) return nullptr;
+
+    if (auth.starts_with("fifo:")) {
+        const char* fifo_path = auth.c_str() + strlen("fifo:");
+
+        int read_fd  = open(fifo_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        int write_fd = open(fifo_path, O_WRONLY | O_CLOEXEC);
+        if (read_fd < 0 || write_fd < 0) {
+            if (read_fd >= 0) close(read_fd);
+            return nullptr;
+        }
+
+        return std::unique_ptr<JobServerClient>(new JobServerClient(read_fd, write_fd, true));
+    }
+
+    int read_fd, write_fd;
+    if (sscanf(auth.c_str(), "%d,%d", &read_fd, &write_fd) != 2) return nullptr;
+
+    // make doesn't pass the fds to commands it doesn't consider recursive
+    if (!is_valid_fd(read_fd) || !is_valid_fd(write_fd)) return nullptr;
+
+    // reopening the pipe gives us a non blocking read end without changing the flags of make's fd,
+    // a blocking read could sleep forever after another process took the token we were polled for
+    std::string proc_path = "/proc/self/fd/" + std::to_string(read_fd);
+    int own_read_fd       = open(proc_path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (own_read_fd < 0) return nullptr;
+
+    return std::unique_ptr<JobServerClient>(new JobServerClient(own_read_fd, write_fd, false));
+}
+
+std::unique_ptr<JobServerClient> JobServerClient::from_fds(int read_fd, int write_fd) {
+    // the read end is the other process's non blocking open
+    return std::unique_ptr<JobServerClient>(new JobServerClient(read_fd, write_fd, true));
+}
+
+JobServerClient::JobServerClient(int read_fd, int write_fd, bool owns_write_fd) {
+    m_read_fd       = read_fd;
+    m_write_fd      = write_fd;
+    m_owns_write_fd = owns_write_fd;
+
+    if (pipe2(m_wake_fds, O_NONBLOCK | O_CLOEXEC) != 0) {
+        m_wake_fds[0] = m_wake_fds[1] = -1;
+    }
+}
+
+JobServerClient::~JobServerClient() {
+    // a token that is never returned is lost for the whole build
+    for (char token : m_held_tokens) {
+        write_byte(m_write_fd, token);
+    }
+
+    close(m_read_fd);
+    if (m_owns_write_fd) close(m_write_fd);
+    if (m_wake_fds[0] >= 0) {
+        close(m_wake_fds[0]);
+        close(m_wake_fds[1]);
+    }
+}
+
+int JobServerClient::acquire() {
+    bool jobserver_alive = true;
+
+    while (true) {
+        {
+            std::lock_guard lock(m_mutex);
+            if (!m_implicit_token_used) {
+                m_implicit_token_used = true;
+                return IMPLICIT_TOKEN;
+            }
+        }
+
+        if (jobserver_alive) {
+            char token;
+            ssize_t result = read(m_read_fd, &token, 1);
+
+            if (result == 1) {
+                std::lock_guard lock(m_mutex);
+                m_held_tokens.push_back(token);
+                return static_cast<unsigned char>(token);
+            }
+
+            // eof or a real error, from now on only the implicit token is left
+            if (result == 0 || (errno != EAGAIN && errno != EINTR)) jobserver_alive = false;
+        }
+
+        pollfd fds[2] = {
+            {.fd = m_wake_fds[0], .events = POLLIN, .revents = 0},
+            {.fd = m_read_fd, .events = POLLIN, .revents = 0},
+        };
+        poll(fds, jobserver_alive ? 2 : 1, -1);
+
+        char drain[16];
+        while (read(m_wake_fds[0], drain, sizeof(drain)) > 0) {}
+    }
+}
+
+void JobServerClient::release(int token) {
+    std::lock_guard lock(m_mutex);
+
+    if (token == IMPLICIT_TOKEN) {
+        m_implicit_token_used = false;
+        write_byte(m_wake_fds[1], 0);
+        return;
+    }
+
+    char byte = static_cast<char>(token);
+    m_held_tokens.erase(std::find(m_held_tokens.begin(), m_held_tokens.end(), byte));
+
+    write_byte(m_write_fd, byte);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// the value of the last --jobserver-auth= or --jobserver-fds= in makeflags, empty if there is none
+std::string jobserver_auth(std::string_view makeflags);
+
+// Client side of the GNU make jobserver protocol (also spoken by ninja), so that our worker threads
+// take part in the job budget of the build that invoked us instead of oversubscribing the machine.
+class JobServerClient {
+public:
+    // Returns nullptr if MAKEFLAGS doesn't name a usable jobserver.
+    static std::unique_ptr<JobServerClient> from_environment();
+    // Takes over the descriptors of another process's client, passed over a socket, so that a compile server
+    // building for that process draws from its jobserver. The server uses the process's implicit job slot.
+    static std::unique_ptr<JobServerClient> from_fds(int read_fd, int write_fd);
+
+    int read_fd() const { return m_read_fd; }
+    int write_fd() const { return m_write_fd; }
+
+    ~JobServerClient();
+
+    // Blocks until this process may run one more job. The returned token has to be given back to release().
+    int acquire();
+    void release(int token);
+
+    JobServerClient(const JobServerClient&)            = delete;
+    JobServerClient& operator=(const JobServerClient&) = delete;
+
+private:
+    JobServerClient(int read_fd, int write_fd, bool owns_write_fd);
+
+private:
+    // every process implicitly owns one job slot that is never read from the jobserver
+    static const int IMPLICIT_TOKEN = -1;
+
+    int m_read_fd; // our own non blocking open of the jobserver
+    int m_write_fd;
+    int m_wake_fds[2]; // written to when the implicit token is released, to wake threads waiting for a token
+    bool m_owns_write_fd;
+
+    std::mutex m_mutex;
+    bool m_implicit_token_used = false;
+    std::vector<char> m_held_tokens; // tokens that still need to be written back
+};
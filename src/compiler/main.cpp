@@ -1,17 +1,68 @@
 #include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
 
+#include "compile_server.hpp"
+#include "db_linker.hpp"
+#include "depfile.hpp"
+#include "include_cache.hpp"
 #include "pipeline_db_builder.hpp"
+#include "remote_cache.hpp"
+#include "watch.hpp"
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s <material_file1.json> [<material_file2.json> ...] -o output_file\n",argv[0]);
+        fprintf(stderr, "Usage: %s <material_file1.json> [<material_file2.json> ...] [-j thread_count] [-I include_dir ...] [--shard i/N] [--full-rebuild] [--watch] [--check] [--deps] [-MD [-MF depfile]] [--no-server] [--server-socket socket] [--processes] [--strip-debug-info [--strip-unused-functions]] [--cache-dir dir [--cache-max-size MB] [--cache-stats]] [--remote-cache socket] [--shm-cache name [--shm-cache-size MB]] -o output_file\n",argv[0]);
+        fprintf(stderr, "       %s --cache-server <socket> <cache_dir>\n", argv[0]);
+        fprintf(stderr, "       %s --serve [--server-socket socket] [-j thread_count] [--strip-debug-info [--strip-unused-functions]] [--cache-dir dir ...] [--remote-cache socket] [--shm-cache name ...]\n", argv[0]);
+        fprintf(stderr, "       %s --link <output_file> <db1.bin> [<db2.bin> ...]\n", argv[0]);
 
         return 1;
     }
 
-    PipelineDBConstructor db_builder;
+    if (strcmp(argv[1], "--cache-server") == 0) {
+        if (argc != 4) {
+            fprintf(stderr, "invalid usage: --cache-server <socket> <cache_dir>\n");
+            return -1;
+        }
+        return run_cache_server(argv[2], argv[3]);
+    }
+
+    if (strcmp(argv[1], "--link") == 0) {
+        if (argc < 4) {
+            fprintf(stderr, "invalid usage: --link <output_file> <db1.bin> [<db2.bin> ...]\n");
+            return -1;
+        }
+        return run_linker(argv[2], std::span(argv + 3, argc - 3));
+    }
 
-    const char* output_file = "mat_out.bin";
+    const char* output_file  = "mat_out.bin";
+    size_t thread_count      = std::max(std::thread::hardware_concurrency(), 1u);
+    bool use_processes       = false;
+    CompilerSettings compiler_settings;
+    const char* cache_dir    = nullptr;
+    uint64_t cache_max_size  = DEFAULT_CACHE_MAX_MB;
+    bool print_cache_stats   = false;
+    const char* remote_cache = nullptr;
+    const char* shm_cache    = nullptr;
+    size_t shm_cache_size    = 256;
+
+    std::vector<const char*> material_files;
+    std::vector<std::string> include_dirs;
+    bool write_dependencies   = false;
+    bool incremental          = true;
+    bool watch                = false;
+    bool check                = false;
+    bool print_dependencies   = false;
+    unsigned shard_index      = 0;
+    unsigned shard_count      = 1;
+    const char* depfile       = nullptr;
+    bool serve                = false;
+    bool use_server           = true;
+    std::string server_socket; // empty for the default
 
     for (int i = 1; i < argc; ++i) {
         const char* arg = argv[i];
@@ -26,10 +77,345 @@ int main(int argc, char* argv[]) {
             continue;
         }
 
-        db_builder.compile_material_file(arg);
+        if (strcmp(arg, "-j") == 0) {
+            i++;
+            if (i >= argc || atoi(argv[i]) <= 0) {
+                fprintf(stderr, "invalid usage: -j <thread_count>\n");
+                return -1;
+            }
+            thread_count = atoi(argv[i]);
+            continue;
+        }
+
+        if (strncmp(arg, "-I", 2) == 0) {
+            if (arg[2] == '\0') {
+                i++;
+                if (i >= argc) {
+                    fprintf(stderr, "invalid usage: -I <include_directory>\n");
+                    return -1;
+                }
+                arg = argv[i];
+            } else {
+                arg += 2;
+            }
+            include_dirs.push_back(arg);
+            continue;
+        }
+
+        if (strcmp(arg, "--shard") == 0) {
+            i++;
+            if (i >= argc || sscanf(argv[i], "%u/%u", &shard_index, &shard_count) != 2 || shard_index >= shard_count) {
+                fprintf(stderr, "invalid usage: --shard <index>/<count>, with index < count\n");
+                return -1;
+            }
+            continue;
+        }
+
+        if (strcmp(arg, "--watch") == 0) {
+            watch = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--check") == 0) {
+            check = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--deps") == 0) {
+            print_dependencies = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--full-rebuild") == 0) {
+            incremental = false;
+            continue;
+        }
+
+        if (strcmp(arg, "-MD") == 0) {
+            write_dependencies = true;
+            continue;
+        }
+
+        if (strcmp(arg, "-MF") == 0) {
+            i++;
+            if (i >= argc) {
+                fprintf(stderr, "invalid usage: -MF <depfile>\n");
+                return -1;
+            }
+            depfile = argv[i];
+            continue;
+        }
+
+        if (strcmp(arg, "--cache-dir") == 0) {
+            i++;
+            if (i >= argc) {
+                fprintf(stderr, "invalid usage: --cache-dir <cache_directory>\n");
+                return -1;
+            }
+            cache_dir = argv[i];
+            continue;
+        }
+
+        if (strcmp(arg, "--cache-max-size") == 0) {
+            i++;
+            if (i >= argc || atoi(argv[i]) <= 0) {
+                fprintf(stderr, "invalid usage: --cache-max-size <megabytes>\n");
+                return -1;
+            }
+            cache_max_size = atoi(argv[i]);
+            continue;
+        }
+
+        if (strcmp(arg, "--cache-stats") == 0) {
+            print_cache_stats = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--remote-cache") == 0) {
+            i++;
+            if (i >= argc) {
+                fprintf(stderr, "invalid usage: --remote-cache <socket>\n");
+                return -1;
+            }
+            remote_cache = argv[i];
+            continue;
+        }
+
+        if (strcmp(arg, "--shm-cache") == 0) {
+            i++;
+            if (i >= argc) {
+                fprintf(stderr, "invalid usage: --shm-cache <segment_name>\n");
+                return -1;
+            }
+            shm_cache = argv[i];
+            continue;
+        }
+
+        if (strcmp(arg, "--shm-cache-size") == 0) {
+            i++;
+            if (i >= argc || atoi(argv[i]) <= 0) {
+                fprintf(stderr, "invalid usage: --shm-cache-size <megabytes>\n");
+                return -1;
+            }
+            shm_cache_size = atoi(argv[i]);
+            continue;
+        }
+
+        if (strcmp(arg, "--serve") == 0) {
+            serve = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--no-server") == 0) {
+            use_server = false;
+            continue;
+        }
+
+        if (strcmp(arg, "--server-socket") == 0) {
+            i++;
+            if (i >= argc) {
+                fprintf(stderr, "invalid usage: --server-socket <socket>\n");
+                return -1;
+            }
+            server_socket = argv[i];
+            continue;
+        }
+
+        if (strcmp(arg, "--processes") == 0) {
+            use_processes = true;
+            continue;
+        }
+
+        // the stages are then compiled from their preprocessed text, so stages that preprocess the same share a compile
+        if (strcmp(arg, "--strip-debug-info") == 0) {
+            compiler_settings.debug_info = false;
+            continue;
+        }
+
+        // the compiler front end doesn't parse library functions the stage never calls
+        if (strcmp(arg, "--strip-unused-functions") == 0) {
+            compiler_settings.strip_unused_functions = true;
+            continue;
+        }
+
+        material_files.push_back(arg);
+    }
+
+    // with debug info the source is compiled as written, the SPIR-V carries it
+    if (compiler_settings.strip_unused_functions && compiler_settings.debug_info) {
+        fprintf(stderr, "--strip-unused-functions only applies with --strip-debug-info, ignoring it\n");
+        compiler_settings.strip_unused_functions = false;
+    }
+
+    // everything a build depends on besides the request, a compile server only builds for clients that agree on it
+    auto absolute_path        = [](const char* path) { return path ? fs::absolute(path).native() : std::string(); };
+    std::string build_options = ShaderCompilerContext::make_options_key(compiler_settings) + " processes=" + (use_processes ? "1" : "0") +
+                                " cache-dir=" + absolute_path(cache_dir) + " cache-max-size=" + std::to_string(cache_max_size) +
+                                " remote-cache=" + absolute_path(remote_cache) + " shm-cache=" + (shm_cache ? shm_cache : "") +
+                                " shm-cache-size=" + std::to_string(shm_cache_size);
+
+    BuildRequest request{
+        .working_directory  = fs::current_path().native(),
+        .material_files     = std::vector<std::string>(material_files.begin(), material_files.end()),
+        .output_file        = output_file,
+        .include_dirs       = include_dirs,
+        .incremental        = incremental,
+        .shard_index        = shard_index,
+        .shard_count        = shard_count,
+        .write_dependencies = write_dependencies,
+        .depfile            = depfile ? depfile : "",
+        .print_cache_stats  = print_cache_stats,
+        .options            = build_options,
+    };
+
+    // looked up only when it's used, finding the default creates a directory in /tmp
+    bool try_server = use_server && !serve && !watch && !check && !print_dependencies;
+    if ((serve || try_server) && server_socket.empty()) server_socket = default_server_socket();
+
+    // a running compile server has everything warm already
+    if (try_server && !server_socket.empty()) {
+        int exit_code;
+        if (run_on_server(server_socket.c_str(), request, exit_code)) return exit_code;
+    }
+
+    if (serve && use_processes) {
+        fprintf(stderr, "--serve can't be combined with --processes\n");
+        return -1;
+    }
+    if (serve && server_socket.empty()) {
+        fprintf(stderr, "/tmp/shader_compiler-%u is not a private directory of this user, pass --server-socket\n", unsigned(getuid()));
+        return -1;
+    }
+
+    // before the worker processes are forked so they see them too
+    IncludeCache::process_cache().set_include_dirs(std::move(include_dirs));
+    // the files are edited while a long running process still holds them
+    if (serve || watch) IncludeCache::process_cache().set_map_files(false);
+
+    PipelineDBConstructor db_builder(thread_count, use_processes, compiler_settings);
+
+    // nothing is compiled, the includes are found by scanning the sources
+    if (check || print_dependencies) {
+        db_builder.set_shard(shard_index, shard_count);
+
+        std::vector<std::string> outdated;
+        bool up_to_date = db_builder.up_to_date(material_files, output_file, outdated);
+
+        if (print_dependencies) {
+            for (auto& dependency : db_builder.dependencies()) {
+                printf("%s\n", dependency.c_str());
+            }
+        }
+        if (check) {
+            for (auto& name : outdated) {
+                printf("out of date: %s\n", name.c_str());
+            }
+            if (!up_to_date) printf("%s is out of date\n", output_file);
+        }
+
+        return check && !up_to_date ? 1 : 0;
+    }
+
+    // checked first, a process that builds again and again keeps everything it compiled
+    if (serve || watch) db_builder.add_cache(std::make_unique<MemoryCacheBackend>(DEFAULT_MEMORY_CACHE_MB << 20));
+
+    DirectoryCacheBackend* directory_cache = nullptr;
+    if (cache_dir) {
+        auto cache      = std::make_unique<DirectoryCacheBackend>(cache_dir, cache_max_size << 20);
+        directory_cache = cache.get();
+        db_builder.add_cache(std::move(cache));
+    }
+
+    if (remote_cache) {
+        try {
+            db_builder.add_cache(std::make_unique<RemoteCacheBackend>(remote_cache));
+        } catch (const std::exception& e) {
+            fprintf(stderr, "%s, continuing without it\n", e.what());
+        }
+    }
+
+    if (shm_cache) {
+        try {
+            db_builder.enable_shared_cache(shm_cache, shm_cache_size << 20);
+        } catch (const std::exception& e) {
+            fprintf(stderr, "%s, continuing without it\n", e.what());
+        }
+    }
+
+    // relative paths of the request are relative to the working directory of the include cache
+    auto build = [&](const BuildRequest& request, FILE* out, FILE* err) {
+        db_builder.set_error_output(err);
+        db_builder.set_incremental(request.incremental);
+        db_builder.set_shard(request.shard_index, request.shard_count);
+
+        std::vector<const char*> material_files;
+        for (auto& material_file : request.material_files) {
+            material_files.push_back(material_file.c_str());
+        }
+        const char* output_file = request.output_file.c_str();
+
+        const IncludeCache& include_cache = IncludeCache::process_cache();
+        std::string history_file          = include_cache.in_working_directory(request.output_file + ".timings");
+        db_builder.load_compile_history(history_file.c_str());
+
+        bool success = db_builder.build(material_files, output_file);
+        db_builder.save_compile_history(history_file.c_str());
+
+        if (request.write_dependencies) {
+            std::string depfile_name = request.depfile.empty() ? request.output_file + ".d" : request.depfile;
+            if (!write_depfile(depfile_name.c_str(), output_file, db_builder.dependencies(), include_cache.working_directory())) {
+                fprintf(err, "failed to write depfile: %s\n", depfile_name.c_str());
+                success = false;
+            }
+        }
+
+        if (db_builder.reused_pipelines() > 0) {
+            fprintf(out, "%zu unchanged pipelines copied from the previous output\n", db_builder.reused_pipelines());
+        }
+        if (db_builder.deduplicated_stages() > 0) {
+            fprintf(out, "%zu stages reused an identical compile\n", db_builder.deduplicated_stages());
+        }
+        for (auto& cache : db_builder.caches()) {
+            fprintf(out, "%s: %zu hits, %zu misses\n", cache->name(), cache->hits(), cache->misses());
+        }
+        if (auto* shared_cache = db_builder.shared_cache()) {
+            fprintf(out, "shared memory cache: %zu hits, %zu misses\n", shared_cache->hits(), shared_cache->misses());
+        }
+        if (request.print_cache_stats && directory_cache) {
+            CacheStats stats = directory_cache->stats();
+
+            uint64_t lookups = stats.hits + stats.misses;
+            fprintf(out, "shader cache stats: %llu entries, %.1f MB of %llu MB, %.1f%% hit rate over %llu lookups, %llu evictions\n",
+                (unsigned long long)stats.entries, stats.bytes / double(1 << 20), (unsigned long long)cache_max_size,
+                lookups ? 100.0 * stats.hits / lookups : 0.0, (unsigned long long)lookups, (unsigned long long)stats.evictions);
+        } else if (request.print_cache_stats) {
+            fprintf(err, "--cache-stats needs --cache-dir\n");
+        }
+
+        return success;
+    };
+
+    if (serve) {
+        return run_compile_server(server_socket.c_str(), build_options, [&](const BuildRequest& request, ServedClient& client) {
+            // the files may have been edited since the last request
+            IncludeCache::process_cache().revalidate();
+            IncludeCache::process_cache().set_working_directory(request.working_directory);
+            IncludeCache::process_cache().set_include_dirs(request.include_dirs);
+
+            db_builder.set_jobserver(std::move(client.jobserver));
+            bool success = build(request, client.out, client.err);
+            db_builder.set_jobserver(nullptr);
+
+            return success;
+        });
     }
 
-    db_builder.dump_to_file(output_file);
+    if (watch) {
+        return run_watch([&] {
+            build(request, stdout, stderr);
+            return db_builder.dependencies();
+        });
+    }
 
-    return 0;
-}
\ No newline at end of file
+    return build(request, stdout, stderr) ? 0 : 1;
+}
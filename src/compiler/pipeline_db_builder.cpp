@@ -1,11 +1,39 @@
 #include "pipeline_db_builder.hpp"
 
+#include <algorithm>
+#include <bit>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
+#include <deque>
+#include <semaphore>
+#include <thread>
 
+#include "bounded_queue.hpp"
+#include "include_cache.hpp"
 #include "shader_compiler.hpp"
 #include "vk_utlls.hpp"
 
+// rough compile cost of a shader we have no timing history for
+const uint64_t ESTIMATED_US_PER_SOURCE_BYTE = 10;
+
+const size_t QUEUE_CAPACITY_PER_THREAD         = 16;
+const size_t MAX_INFLIGHT_PIPELINES_PER_THREAD = 32;
+const size_t MAX_STAGES_PER_PIPELINE           = sizeof(CompiledPipeline::stages) / sizeof(CompiledSpv);
+// every combination is a pipeline of its own, more than this is most likely a mistake in the material
+const size_t MAX_VARIANT_COMBINATIONS          = 4096;
+
+static const std::vector<std::pair<std::string, std::string>> NO_DEFINITIONS;
+
+// relative to the working directory of the build, see IncludeCache::set_working_directory
+static std::string in_working_directory(const std::string& path) {
+    return IncludeCache::process_cache().in_working_directory(path);
+}
+
+struct ByPredictedTime {
+    bool operator()(const StageJob* a, const StageJob* b) const { return a->predicted_time_us < b->predicted_time_us; }
+};
+
 void if_exist(nh::json::value_type& root, const char* field, auto&& func) {
     if (root.contains(field)) func(root.at(field));
 }
@@ -13,7 +41,11 @@ void if_exist(nh::json::value_type& root, const char* field, auto&& func) {
 void try_to_get_field_into_char_arr(nh::json::value_type& root, const char* field, std::span<char> cstr) {
     if_exist(root, field, [&](nh::json::value_type& val) {
         auto str_val = val.get<std::string>();
-        memcpy(cstr.data(), str_val.c_str(), std::min(cstr.size(), str_val.size()));
+
+        // terminated, the default value may be longer
+        size_t length = std::min(cstr.size() - 1, str_val.size());
+        memcpy(cstr.data(), str_val.c_str(), length);
+        cstr[length] = '\0';
     });
 }
 
@@ -32,30 +64,64 @@ void set_default_values(CompiledPipeline* pipelinedb) {
     memset(pipelinedb->stages, 0, sizeof(pipelinedb->stages));
 }
 
-bool PipelineDBConstructor::compile_material_file(const char* file_name) {
+PipelineDBConstructor::PipelineDBConstructor(size_t thread_count, bool use_worker_processes, const CompilerSettings& settings)
+    : m_process_pool(use_worker_processes ? std::make_unique<ProcessWorkerPool>(thread_count, settings) : nullptr),
+      m_jobserver(JobServerClient::from_environment()),
+      m_pool(thread_count) {
+    for (size_t i = 0; i < m_pool.thread_count(); ++i) {
+        m_scratch.push_back(std::make_unique<vke::ArenaAllocator>());
+        m_compiler_contexts.push_back(std::make_unique<ShaderCompilerContext>(settings));
+    }
+}
+
+std::vector<std::string> PipelineDBConstructor::dependencies() const {
+    return std::vector<std::string>(m_dependencies.begin(), m_dependencies.end());
+}
+
+void PipelineDBConstructor::enable_shared_cache(const char* name, size_t budget_bytes) {
+    m_shared_cache = std::make_unique<SharedMemoryCache>(name, budget_bytes);
+    m_scanner.set_shared_cache(m_shared_cache.get());
+
+    for (auto& context : m_compiler_contexts) {
+        context->set_shared_cache(m_shared_cache.get());
+    }
+}
+
+bool PipelineDBConstructor::load_material_file(const char* file_name, vke::ArenaAllocator* arena, std::vector<std::unique_ptr<PipelineJob>>& out_jobs) {
     fs::path path = file_name;
     path          = path.parent_path();
 
-    m_scratch.reset();
-
-    auto fdata = read_file(&m_scratch, file_name);
+    auto fdata = read_file(arena, in_working_directory(file_name).c_str());
     auto json  = nh::json::parse(fdata);
 
     auto arr = json["pipelines"];
-    if (!arr.is_array()) return false;
+    if (!arr.is_array()) {
+        fprintf(m_errors, "error while loading material file %s: \"pipelines\" has to be a list\n", file_name);
+        return false;
+    }
 
+    // a broken pipeline is left out, the others are still built
+    bool success = true;
     for (auto& val : arr) {
-
-        auto* pipelinedb = compile_pipeline(val, path);
-        if (pipelinedb)
-            m_pipelinedbs.push_back(pipelinedb);
+        auto job = std::make_unique<PipelineJob>();
+        if (!parse_pipeline(*job, val, path, arena)) {
+            success = false;
+            continue;
+        }
+
+        if (val.contains("variants")) {
+            success = expand_variants(*job, val["variants"], arena, out_jobs) && success;
+        } else {
+            out_jobs.push_back(std::move(job));
+        }
     }
 
-    return true;
+    return success;
 }
 
-CompiledPipeline* PipelineDBConstructor::compile_pipeline(nh::json::value_type& val, fs::path material_dir) {
-    auto* pipelinedb = m_data.calloc<CompiledPipeline>();
+bool PipelineDBConstructor::parse_pipeline(PipelineJob& job, nh::json::value_type& val, fs::path material_dir, vke::ArenaAllocator* arena) {
+    auto* pipelinedb = arena->calloc<CompiledPipeline>();
+    job.pipelinedb   = pipelinedb;
 
     try {
         set_default_values(pipelinedb);
@@ -87,40 +153,768 @@ CompiledPipeline* PipelineDBConstructor::compile_pipeline(nh::json::value_type&
             }
         });
 
+        // the stages of an uber file, a .glsl file that is compiled once per stage with the stage's macro defined
+        std::vector<VkShaderStageFlagBits> uber_stages;
+        if_exist(val, "stages", [&](nh::json::value_type& val) {
+            for (auto& stage : val) {
+                uber_stages.push_back(parse_shader_stage(stage.get<std::string>()));
+            }
+        });
+
         if_exist(val, "shader_files", [&](nh::json::value_type& val) {
             if (val.is_array()) {
                 for (auto& shader_file : val) {
                     std::string shader_path = material_dir / shader_file.get<std::string>();
-                    if (!compile_stage(pipelinedb, shader_path, definitions)) {
-                        // TODO Handle compilation failure
+
+                    if (!shader_path.ends_with(".glsl")) {
+                        job.stages.push_back(StageJob{
+                            .pipeline    = &job,
+                            .shader_path = shader_path,
+                            .stage       = infer_shader_stage(shader_path),
+                            .definitions = definitions,
+                        });
+                        continue;
+                    }
+
+                    if (uber_stages.empty()) throw std::runtime_error(shader_path + " holds several stages, list them in \"stages\"");
+                    for (VkShaderStageFlagBits stage : uber_stages) {
+                        job.stages.push_back(StageJob{
+                            .pipeline    = &job,
+                            .shader_path = shader_path,
+                            .stage       = stage,
+                            .definitions = definitions,
+                        });
+                    }
+                }
+            }
+        });
+
+        if (job.stages.size() > MAX_STAGES_PER_PIPELINE) {
+            throw std::runtime_error("a pipeline can't have more than " + std::to_string(MAX_STAGES_PER_PIPELINE) + " stages");
+        }
+    } catch (const std::exception& e) {
+        fprintf(m_errors, "error while compiling pipeline: %s\n", e.what());
+        return false;
+    }
+
+    job.remaining_stages = job.stages.size();
+
+    return true;
+}
+
+bool PipelineDBConstructor::expand_variants(const PipelineJob& job, nh::json::value_type& variants, vke::ArenaAllocator* arena, std::vector<std::unique_ptr<PipelineJob>>& out_jobs) {
+    const char* name = job.pipelinedb->shader_name;
+    std::string_view base_name(name, strnlen(name, sizeof(job.pipelinedb->shader_name)));
+
+    struct Dimension {
+        std::string macro;
+        uint32_t shift;
+        std::vector<std::string> values;
+    };
+
+    std::vector<Dimension> dimensions;
+    uint32_t mask_bits  = 0;
+    uint32_t max_mask   = 0;
+    size_t combinations = 1;
+    try {
+        if (!variants.is_object()) throw std::runtime_error("\"variants\" has to map macros to lists of values");
+
+        // json objects keep their keys sorted, which is the bit order the runtime expects
+        for (auto it = variants.begin(); it != variants.end(); ++it) {
+            if (!it.value().is_array() || it.value().empty()) throw std::runtime_error("the values of " + it.key() + " have to be a non empty list");
+
+            Dimension& dimension = dimensions.emplace_back(Dimension{.macro = it.key(), .shift = mask_bits, .values = {}});
+            for (auto& value : it.value()) {
+                dimension.values.push_back(value.is_string() ? value.get<std::string>() : value.dump());
+            }
+
+            combinations *= dimension.values.size();
+            if (combinations > MAX_VARIANT_COMBINATIONS) {
+                throw std::runtime_error("more than " + std::to_string(MAX_VARIANT_COMBINATIONS) + " combinations of variants");
+            }
+
+            mask_bits += std::bit_width(dimension.values.size() - 1);
+            if (mask_bits > 32) throw std::runtime_error("the variant mask doesn't fit into 32 bits");
+
+            // a macro with a single value takes no bits, its shift may be 32
+            if (dimension.values.size() > 1) max_mask |= uint32_t(dimension.values.size() - 1) << dimension.shift;
+        }
+
+        if (base_name.size() + 1 + std::to_string(max_mask).size() >= sizeof(job.pipelinedb->shader_name)) {
+            throw std::runtime_error("the name is too long for the variant names");
+        }
+    } catch (const std::exception& e) {
+        fprintf(m_errors, "error in the variants of pipeline %.*s: %s\n", int(base_name.size()), base_name.data(), e.what());
+        return false;
+    }
+
+    uint32_t name_hash = pipeline_name_hash(base_name);
+    for (size_t combination = 0; combination < combinations; ++combination) {
+        auto variant        = std::make_unique<PipelineJob>();
+        variant->pipelinedb = arena->create_copy(*job.pipelinedb);
+
+        // the first macro changes fastest, so the masks come out in increasing order
+        std::vector<std::pair<std::string, std::string>> definitions;
+        uint32_t mask    = 0;
+        size_t remaining = combination;
+        for (auto& dimension : dimensions) {
+            size_t index = remaining % dimension.values.size();
+            remaining /= dimension.values.size();
+
+            if (index > 0) mask |= uint32_t(index) << dimension.shift;
+            definitions.emplace_back(dimension.macro, dimension.values[index]);
+        }
+
+        snprintf(variant->pipelinedb->shader_name, sizeof(variant->pipelinedb->shader_name), "%.*s#%u", int(base_name.size()), base_name.data(), mask);
+        variant->variant = PipelineVariant{.name_hash = name_hash, .variant_mask = mask, .pipeline_offset = 0};
+
+        for (auto& stage : job.stages) {
+            // a variant macro replaces a compiler definition of the same name
+            auto stage_definitions = stage.definitions;
+            std::erase_if(stage_definitions, [&](auto& definition) {
+                return std::any_of(definitions.begin(), definitions.end(), [&](auto& variant_definition) { return variant_definition.first == definition.first; });
+            });
+            stage_definitions.insert(stage_definitions.end(), definitions.begin(), definitions.end());
+
+            variant->stages.push_back(StageJob{
+                .pipeline    = variant.get(),
+                .shader_path = stage.shader_path,
+                .stage       = stage.stage,
+                .definitions = std::move(stage_definitions),
+            });
+        }
+        variant->remaining_stages = variant->stages.size();
+
+        out_jobs.push_back(std::move(variant));
+    }
+
+    return true;
+}
+
+bool PipelineDBConstructor::build(std::span<const char* const> material_files, const char* output_file) {
+    m_previous         = PreviousOutput();
+    m_reused_pipelines = 0;
+    if (m_incremental) load_previous_output(output_file);
+
+    // the previous output stays readable until the new one replaces it
+    std::string output_path = in_working_directory(output_file);
+    std::string tmp_file    = output_path + ".tmp";
+    std::ofstream file(tmp_file, std::ios::out | std::ios::binary);
+    if (!file.is_open()) {
+        fprintf(m_errors, "failed to open output file: %s\n", tmp_file.c_str());
+        return false;
+    }
+
+    size_t thread_count   = m_pool.thread_count();
+    m_deduplicated_stages = 0;
+
+    m_dependencies.clear();
+    m_dependencies.insert(material_files.begin(), material_files.end());
+
+    // cleared when a pipeline can't be built, the others are still written
+    std::atomic<bool> all_built = true;
+
+    // pipelines in the order they are written, guarded by mutex
+    std::deque<std::unique_ptr<PipelineJob>> submitted;
+    size_t submitted_files = 0;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    // caps the number of pipelines between being parsed and being written
+    std::counting_semaphore<> inflight_slots(MAX_INFLIGHT_PIPELINES_PER_THREAD * thread_count);
+
+    BoundedQueue<StageJob*> load_queue(QUEUE_CAPACITY_PER_THREAD * thread_count);
+    // Longest jobs first so a huge shader doesn't end up compiling alone at the end of the build. Only the stages
+    // of the pipelines in flight are sorted, so the queue holds all of them; a long stage of a pipeline that is
+    // parsed after most of the build has been written can still finish last.
+    BoundedQueue<StageJob*, ByPredictedTime> compile_queue(MAX_INFLIGHT_PIPELINES_PER_THREAD * MAX_STAGES_PER_PIPELINE * thread_count);
+
+    auto finish_stage = [&](StageJob& stage) {
+        if (--stage.pipeline->remaining_stages == 0) {
+            std::lock_guard lock(mutex);
+            cv.notify_all();
+        }
+    };
+
+    auto finish_parsing = [&] {
+        std::lock_guard lock(mutex);
+        submitted_files = material_files.size();
+        cv.notify_all();
+        load_queue.close();
+    };
+
+    // stage 1: parse the material files concurrently but submit their pipelines in command line order
+    std::atomic<size_t> next_file = 0;
+    std::vector<std::thread> parsers;
+    for (size_t i = 0; i < std::min(material_files.size(), thread_count); ++i) {
+        parsers.emplace_back([&, i] {
+            for (size_t index = next_file++; index < material_files.size(); index = next_file++) {
+                std::vector<std::unique_ptr<PipelineJob>> jobs;
+                try {
+                    if (!load_material_file(material_files[index], m_scratch[i].get(), jobs)) all_built = false;
+                } catch (const std::exception& e) {
+                    fprintf(m_errors, "error while loading material file %s: %s\n", material_files[index], e.what());
+                    all_built = false;
+                }
+
+                std::erase_if(jobs, [&](auto& job) { return !in_shard(*job); });
+                for (auto& job : jobs) {
+                    scan_stages(*job);
+                    if (m_incremental && find_previous(*job)) job->remaining_stages = 0;
+                }
+
+                {
+                    std::unique_lock lock(mutex);
+                    cv.wait(lock, [&] { return submitted_files == index; });
+                }
+
+                for (auto& job : jobs) {
+                    inflight_slots.acquire();
+
+                    // the pipeline can be written and freed as soon as its last stage is pushed
+                    std::vector<StageJob*> stages;
+                    if (!job->previous) {
+                        for (auto& stage : job->stages) stages.push_back(&stage);
+                    }
+
+                    {
+                        std::lock_guard lock(mutex);
+                        submitted.push_back(std::move(job));
+                        cv.notify_all();
+                    }
+
+                    for (StageJob* stage : stages) {
+                        load_queue.push(stage);
                     }
                 }
+
+                if (index + 1 == material_files.size()) {
+                    finish_parsing();
+                } else {
+                    std::lock_guard lock(mutex);
+                    submitted_files++;
+                    cv.notify_all();
+                }
             }
         });
+    }
+    if (material_files.empty()) finish_parsing();
+
+    // stage 2: read the sources and estimate how long they take to compile
+    std::thread loader([&] {
+        while (auto stage = load_queue.pop()) {
+            // duplicates never get to the compile queue
+            if (defer_to_identical_stage(**stage, finish_stage)) continue;
+
+            load_stage(**stage);
+            compile_queue.push(*stage);
+        }
+        compile_queue.close();
+    });
+
+    // stage 4: append the finished pipelines to the file in submission order so the output is deterministic
+    bool write_ok = true;
+    std::thread writer([&] {
+        ShaderDBHeader header{};
+        header.magic   = SHADER_DB_MAGIC;
+        header.version = SHADER_DB_VERSION;
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        std::vector<PipelineVariant> variants;
+        for (size_t index = 0;; ++index) {
+            PipelineJob* job;
+            {
+                std::unique_lock lock(mutex);
+                cv.wait(lock, [&] { return index < submitted.size() || submitted_files == material_files.size(); });
+                if (index >= submitted.size()) break;
+
+                job = submitted[index].get();
+                cv.wait(lock, [&] { return job->remaining_stages == 0; });
+            }
+
+            uint32_t offset = file.tellp();
+            if (write_pipeline(file, *job)) {
+                header.shader_count++;
+
+                if (job->variant) {
+                    job->variant->pipeline_offset = offset;
+                    variants.push_back(*job->variant);
+                }
+            } else {
+                all_built = false;
+            }
+
+            {
+                std::lock_guard lock(mutex);
+                submitted[index].reset();
+            }
+            inflight_slots.release();
+        }
+
+        header.variant_count        = variants.size();
+        header.variant_table_offset = file.tellp();
+        file.write(reinterpret_cast<const char*>(variants.data()), variants.size() * sizeof(PipelineVariant));
+
+        header.total_size = file.tellp();
+
+        file.seekp(0);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        file.close();
+        write_ok = !file.fail();
+    });
+
+    // stage 3: compile on the pool
+    m_pool.parallel_for(thread_count, [&](size_t, size_t worker_id) {
+        while (auto stage = compile_queue.pop()) {
+            StageJob& job = **stage;
+            if (job.error.empty()) {
+                // every compile beyond the first one needs a token from the build's jobserver
+                int token = m_jobserver ? m_jobserver->acquire() : 0;
+                compile_stage(job, worker_id);
+                if (m_jobserver) m_jobserver->release(token);
+            }
+
+            // before finishing job, its pipeline may be gone right after
+            std::vector<StageJob*> identical_stages;
+            if (job.identical) {
+                std::lock_guard lock(job.identical->mutex);
+                job.identical->done  = true;
+                job.identical->spv   = job.spv;
+                job.identical->error = job.error;
+                identical_stages.swap(job.identical->waiting);
+            }
+
+            for (StageJob* identical : identical_stages) {
+                identical->spv       = job.spv;
+                identical->error     = job.error;
+                identical->cache_hit = true;
+                finish_stage(*identical);
+            }
+            finish_stage(job);
+        }
+    });
+
+    for (auto& parser : parsers) {
+        parser.join();
+    }
+    loader.join();
+    writer.join();
+
+    // the pipelines that did build are kept so the next build only has to compile the broken ones
+    std::error_code ec;
+    if (write_ok) fs::rename(tmp_file, output_path, ec);
+    write_ok   = write_ok && !ec;
+    m_previous = PreviousOutput();
+
+    for (auto& scratch : m_scratch) {
+        scratch->reset();
+    }
+    m_deduplicated_stages += m_compiled.reused();
+    m_compiled.clear();
+    m_identical_stages.clear();
+
+    return write_ok && all_built;
+}
+
+bool PipelineDBConstructor::up_to_date(std::span<const char* const> material_files, const char* output_file, std::vector<std::string>& out_outdated) {
+    m_previous = PreviousOutput();
+    bool valid = load_previous_output(output_file);
+
+    m_dependencies.clear();
+    m_dependencies.insert(material_files.begin(), material_files.end());
+
+    // parsed and scanned concurrently, compared in command line order
+    std::vector<std::vector<std::unique_ptr<PipelineJob>>> jobs(material_files.size());
+    std::atomic<bool> loaded = true;
+    m_pool.parallel_for(material_files.size(), [&](size_t index, size_t worker_id) {
+        try {
+            if (!load_material_file(material_files[index], m_scratch[worker_id].get(), jobs[index])) loaded = false;
+        } catch (const std::exception& e) {
+            fprintf(m_errors, "error while loading material file %s: %s\n", material_files[index], e.what());
+            loaded = false;
+        }
+
+        std::erase_if(jobs[index], [&](auto& job) { return !in_shard(*job); });
+        for (auto& job : jobs[index]) {
+            scan_stages(*job);
+        }
+    });
+
+    // the previous output has to hold exactly these pipelines in this order
+    size_t matched                        = 0;
+    bool in_order                         = true;
+    const CompiledPipeline* last_previous = nullptr;
+    for (auto& file_jobs : jobs) {
+        for (auto& job : file_jobs) {
+            add_dependencies(*job);
+
+            if (!find_previous(*job)) {
+                const char* name = job->pipelinedb->shader_name;
+                out_outdated.emplace_back(name, strnlen(name, sizeof(job->pipelinedb->shader_name)));
+                continue;
+            }
+
+            in_order      = in_order && job->previous > last_previous;
+            last_previous = job->previous;
+            matched++;
+        }
+    }
+    bool unchanged = valid && loaded && in_order && out_outdated.empty() && matched == m_previous.pipelines.size();
+
+    m_previous = PreviousOutput();
+    for (auto& scratch : m_scratch) {
+        scratch->reset();
+    }
+
+    return unchanged;
+}
+
+Hash PipelineDBConstructor::fingerprint(const PipelineJob& job) const {
+    Hasher hasher;
+    hasher.update_str(m_compiler_contexts[0]->options_key());
+
+    auto& include_dirs = IncludeCache::process_cache().include_dirs();
+    hasher.update_u64(include_dirs.size());
+    for (auto& dir : include_dirs) {
+        hasher.update_str(dir);
+    }
+
+    // the render state, the stages aren't filled in yet
+    hasher.update(job.pipelinedb, sizeof(CompiledPipeline));
+
+    hasher.update_u64(job.stages.size());
+    for (const StageJob& stage : job.stages) {
+        // the stages of an uber file share the path, their order in the record is told apart by the stage
+        hasher.update_u64(stage.stage);
+        hasher.update_str(stage.shader_path);
+        hasher.update_u64(stage.definitions.size());
+        for (auto& [name, definition] : stage.definitions) {
+            hasher.update_str(name);
+            hasher.update_str(definition);
+        }
+
+        hasher.update_u64(stage.inputs.size());
+        for (auto& [path, content_hash] : stage.inputs) {
+            hasher.update_str(path);
+            hasher.update(content_hash.data(), content_hash.size());
+        }
+    }
+
+    return hasher.finish();
+}
+
+Hash PipelineDBConstructor::stage_key(const StageJob& stage) const {
+    Hasher hasher;
+    hasher.update_str(m_compiler_contexts[0]->options_key());
+    hasher.update_u64(stage.stage);
+    hasher.update_str(stage.shader_path);
+
+    hasher.update_u64(stage.definitions.size());
+    for (auto& [name, definition] : stage.definitions) {
+        hasher.update_str(name);
+        hasher.update_str(definition);
+    }
+
+    // the include directories only matter through the paths the includes resolved to
+    hasher.update_u64(stage.inputs.size());
+    for (auto& [path, content_hash] : stage.inputs) {
+        hasher.update_str(path);
+        hasher.update(content_hash.data(), content_hash.size());
+    }
+
+    return hasher.finish();
+}
+
+bool PipelineDBConstructor::in_shard(const PipelineJob& job) const {
+    if (m_shard_count == 1) return true;
+
+    // by name only so every machine agrees on the partition
+    const char* name = job.pipelinedb->shader_name;
+    Hash hash        = hash_data(std::string_view(name, strnlen(name, sizeof(job.pipelinedb->shader_name))));
+
+    uint64_t bits;
+    memcpy(&bits, hash.data(), sizeof(bits));
+    return bits % m_shard_count == m_shard_index;
+}
+
+void PipelineDBConstructor::scan_stages(PipelineJob& job) {
+    for (auto& stage : job.stages) {
+        try {
+            stage.inputs = m_scanner.scan(stage.shader_path);
+        } catch (const std::exception&) {
+            // the stage fails on its own when it is loaded
+        }
+    }
+}
+
+bool PipelineDBConstructor::find_previous(PipelineJob& job) {
+    // a stage that couldn't be scanned won't build
+    for (auto& stage : job.stages) {
+        if (stage.inputs.empty()) return false;
+    }
+
+    Hash key         = fingerprint(job);
+    const char* name = job.pipelinedb->shader_name;
+    auto range       = m_previous.pipelines.equal_range(std::string(name, strnlen(name, sizeof(job.pipelinedb->shader_name))));
+
+    for (auto it = range.first; it != range.second; ++it) {
+        if (memcmp(it->second->fingerprint, key.data(), sizeof(key)) == 0) {
+            job.previous = it->second;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool PipelineDBConstructor::load_previous_output(const char* output_file) {
+    try {
+        m_previous.data = read_file(in_working_directory(output_file).c_str());
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    // anything that doesn't look like a complete database is ignored
+    auto& data = m_previous.data;
+    if (data.size() < sizeof(ShaderDBHeader)) return false;
+
+    auto* header = reinterpret_cast<const ShaderDBHeader*>(data.data());
+    if (!header->is_current() || header->total_size != data.size()) return false;
+
+    size_t offset = sizeof(ShaderDBHeader);
+    for (uint32_t i = 0; i < header->shader_count; ++i) {
+        auto* pipeline = reinterpret_cast<const CompiledPipeline*>(data.data() + offset);
+        if (data.size() - offset < sizeof(CompiledPipeline) || pipeline->total_size < sizeof(CompiledPipeline) || pipeline->total_size > data.size() - offset) {
+            m_previous.pipelines.clear();
+            return false;
+        }
+
+        m_previous.pipelines.emplace(std::string(pipeline->shader_name, strnlen(pipeline->shader_name, sizeof(pipeline->shader_name))), pipeline);
+        offset += pipeline->total_size;
+    }
+
+    return true;
+}
+
+void PipelineDBConstructor::add_dependencies(const PipelineJob& job) {
+    for (auto& stage : job.stages) {
+        // also when it couldn't be read, so that creating it is noticed
+        m_dependencies.insert(stage.shader_path);
+        for (auto& [path, content_hash] : stage.inputs) {
+            m_dependencies.insert(path);
+        }
+    }
+}
+
+bool PipelineDBConstructor::defer_to_identical_stage(StageJob& stage, auto&& finish_stage) {
+    Hash key;
+    try {
+        // the order of the definitions only matters for ones with the same name
+        auto definitions = stage.definitions;
+        std::stable_sort(definitions.begin(), definitions.end(), [](auto& a, auto& b) { return a.first < b.first; });
+
+        Hasher hasher;
+        hasher.update_str(fs::canonical(in_working_directory(stage.shader_path)).native());
+        // with debug info the SPIR-V names the file as it was spelled, like stage_key does
+        if (!m_compiler_contexts[0]->compiles_preprocessed()) hasher.update_str(stage.shader_path);
+        hasher.update_u64(stage.stage);
+        hasher.update_u64(definitions.size());
+        for (auto& [name, definition] : definitions) {
+            hasher.update_str(name);
+            hasher.update_str(definition);
+        }
+        key = hasher.finish();
+    } catch (const std::exception&) {
+        // the stage fails on its own when it is loaded
+        return false;
+    }
+
+    auto [it, inserted] = m_identical_stages.try_emplace(key);
+    if (inserted) {
+        it->second      = std::make_shared<IdenticalStages>();
+        stage.identical = it->second;
+        return false;
+    }
+
+    m_deduplicated_stages++;
+
+    IdenticalStages& identical = *it->second;
+    std::unique_lock lock(identical.mutex);
+    if (!identical.done) {
+        identical.waiting.push_back(&stage);
+        return true;
+    }
+
+    stage.spv       = identical.spv;
+    stage.error     = identical.error;
+    stage.cache_hit = true;
+    lock.unlock();
+
+    finish_stage(stage);
+    return true;
+}
+
+void PipelineDBConstructor::load_stage(StageJob& stage) {
+    // read once for all the stages of an uber file, the scanner has usually read it already
+    size_t source_size = 0;
+    try {
+        stage.source = IncludeCache::process_cache().get(stage.shader_path, m_shared_cache.get());
+        source_size  = stage.source->content.size();
     } catch (const std::exception& e) {
-        fprintf(stderr, "error while compiling pipeline: %s\n", e.what());
-        return nullptr;
+        stage.error = e.what();
     }
 
-    return pipelinedb;
+    stage.predicted_time_us = m_history.predict(CompileHistory::make_key(stage.shader_path, stage.stage, stage.definitions), source_size * ESTIMATED_US_PER_SOURCE_BYTE);
 }
 
-bool PipelineDBConstructor::compile_stage(CompiledPipeline* pipelinedb, const std::string& shader_filename, std::vector<std::pair<std::string, std::string>> definitions) {
-    std::vector<uint32_t> compiled_code = compile_glsl(shader_filename, definitions);
+bool PipelineDBConstructor::write_pipeline(std::ofstream& file, PipelineJob& job) {
+    add_dependencies(job);
+
+    if (job.previous) {
+        m_reused_pipelines++;
+        for (auto& stage : job.stages) {
+            m_history.keep(CompileHistory::make_key(stage.shader_path, stage.stage, stage.definitions));
+        }
+
+        file.write(reinterpret_cast<const char*>(job.previous), job.previous->total_size);
+        return true;
+    }
+
+    auto failed = std::find_if(job.stages.begin(), job.stages.end(), [](const StageJob& stage) { return !stage.error.empty(); });
+    if (failed != job.stages.end()) {
+        fprintf(m_errors, "error while compiling pipeline: %s\n", failed->error.c_str());
+        return false;
+    }
+
+    for (auto& stage : job.stages) {
+        // a cache hit says nothing about how long the compile takes
+        std::string history_key = CompileHistory::make_key(stage.shader_path, stage.stage, stage.definitions);
+        if (stage.cache_hit) m_history.keep(history_key);
+        else m_history.record(history_key, stage.compile_time_us);
+    }
+
+    // from the header as it was parsed, before any stage is added to it
+    Hash key = fingerprint(job);
+
+    m_data.reset();
+
+    auto* pipelinedb = m_data.create_copy(*job.pipelinedb);
+    memcpy(pipelinedb->fingerprint, key.data(), sizeof(pipelinedb->fingerprint));
+    for (auto& stage : job.stages) {
+        if (!append_stage(pipelinedb, stage)) {
+            fprintf(m_errors, "error while compiling pipeline: %s produced no SPIR-V\n", stage.shader_path.c_str());
+            return false;
+        }
+    }
+
+    // Write the CompiledPipeline structure itself
+    file.write(reinterpret_cast<const char*>(pipelinedb), pipelinedb->total_size);
+
+    return true;
+}
+
+void PipelineDBConstructor::compile_stage(StageJob& stage, size_t worker_id) {
+    auto start    = std::chrono::steady_clock::now();
+    auto& context = *m_compiler_contexts[worker_id];
+
+    // keyed by the files the scanner found, a cached stage is neither preprocessed nor compiled
+    Hash key;
+    try {
+        if (stage.inputs.empty()) stage.inputs = m_scanner.scan(stage.shader_path);
+        key             = stage_key(stage);
+        stage.cache_hit = load_cached(key, stage.spv);
+    } catch (const std::exception& e) {
+        stage.error = e.what();
+    }
+
+    // Without debug info the preprocessed text is what gets compiled, without the definitions, so that stages of this
+    // build whose definitions don't change it share one compile. With it the stage is compiled from its own source.
+    bool compile_preprocessed = context.compiles_preprocessed();
+    std::string preprocessed;
+    Hash preprocessed_key;
+    if (compile_preprocessed && !stage.cache_hit && stage.error.empty()) {
+        try {
+            preprocessed     = context.preprocess(stage.shader_path, stage.stage, stage.source->content, stage.definitions);
+            preprocessed_key = context.hash_preprocessed(stage.shader_path, stage.stage, preprocessed);
+        } catch (const std::exception& e) {
+            stage.error = e.what();
+        }
+    }
+
+    if (!stage.cache_hit && stage.error.empty()) {
+        if (compile_preprocessed && m_compiled.acquire(preprocessed_key, stage.spv, stage.error)) {
+            stage.cache_hit = true;
+        } else {
+            std::string_view source = compile_preprocessed ? std::string_view(preprocessed) : stage.source->content;
+            const auto& definitions = compile_preprocessed ? NO_DEFINITIONS : stage.definitions;
+            try {
+                if (m_process_pool) {
+                    stage.spv = m_process_pool->compile_glsl(worker_id, stage.shader_path, stage.stage, source, definitions);
+                } else {
+                    stage.spv = context.compile_glsl(stage.shader_path, stage.stage, source, definitions);
+                }
+            } catch (const std::exception& e) {
+                stage.error = e.what();
+            }
+
+            if (compile_preprocessed) m_compiled.publish(preprocessed_key, stage.spv, stage.error);
+        }
+
+        if (stage.error.empty()) store_cached(key, stage.spv);
+    }
+    stage.source = nullptr;
+
+    stage.compile_time_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool PipelineDBConstructor::load_cached(const Hash& key, std::vector<uint32_t>& out_spv) {
+    if (m_shared_cache) {
+        std::vector<char> value;
+        if (m_shared_cache->get(key, value) && value.size() % sizeof(uint32_t) == 0) {
+            out_spv.resize(value.size() / sizeof(uint32_t));
+            memcpy(out_spv.data(), value.data(), value.size());
+            return true;
+        }
+    }
+
+    for (size_t i = 0; i < m_caches.size(); ++i) {
+        if (!m_caches[i]->load(key, out_spv)) continue;
+
+        // keep it closer for the next lookup, also hands it to the other compiler processes of this build
+        for (size_t j = 0; j < i; ++j) {
+            m_caches[j]->store(key, out_spv);
+        }
+        if (m_shared_cache) m_shared_cache->put(key, std::string_view(reinterpret_cast<const char*>(out_spv.data()), out_spv.size() * sizeof(uint32_t)));
+        return true;
+    }
+
+    return false;
+}
+
+void PipelineDBConstructor::store_cached(const Hash& key, const std::vector<uint32_t>& spv) {
+    if (m_shared_cache) m_shared_cache->put(key, std::string_view(reinterpret_cast<const char*>(spv.data()), spv.size() * sizeof(uint32_t)));
+    for (auto& cache : m_caches) {
+        cache->store(key, spv);
+    }
+}
+
+bool PipelineDBConstructor::append_stage(CompiledPipeline* pipelinedb, const StageJob& stage_job) {
+    const std::vector<uint32_t>& compiled_code = stage_job.spv;
 
     if (compiled_code.empty()) {
         return false;
     }
 
     // Assuming stage_count corresponds to the index of the next stage to be filled
-    if (pipelinedb->stage_count >= 5) {
+    if (pipelinedb->stage_count >= MAX_STAGES_PER_PIPELINE) {
         return false; // Maximum stages reached
     }
 
     CompiledSpv& stage    = pipelinedb->stages[pipelinedb->stage_count];
     stage.size_in_bytes   = compiled_code.size() * sizeof(uint32_t);
     stage.offset_in_bytes = pipelinedb->total_size - sizeof(CompiledPipeline); // total size includes the header
-    stage.stage           = infer_shader_stage(shader_filename);
+    stage.stage           = stage_job.stage;
 
     auto* spv_data = reinterpret_cast<char*>(m_data.alloc(stage.size_in_bytes));
 
@@ -138,30 +932,3 @@ bool PipelineDBConstructor::compile_stage(CompiledPipeline* pipelinedb, const st
 
     return true;
 }
-
-bool PipelineDBConstructor::dump_to_file(const char* file_name) {
-    std::ofstream file(file_name, std::ios::out | std::ios::binary);
-    if (!file.is_open()) {
-        return false;
-    }
-
-    ShaderDBHeader header{
-        .shader_count = static_cast<uint32_t>(m_pipelinedbs.size()),
-    };
-
-    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
-
-    // Iterate over all compiled pipelines
-    for (auto* pipelinedb : m_pipelinedbs) {
-        // Write the CompiledPipeline structure itself
-        file.write(reinterpret_cast<const char*>(pipelinedb), pipelinedb->total_size);
-    }
-
-    header.total_size = file.tellp();
-
-    file.seekp(offsetof(ShaderDBHeader, total_size));
-    file.write(reinterpret_cast<const char*>(&header.total_size), sizeof(header.total_size));
-
-    file.close();
-    return true;
-}
\ No newline at end of file
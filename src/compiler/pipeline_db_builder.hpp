@@ -3,28 +3,176 @@
 #include <json.hpp>
 #include <string>
 #include <vulkan/vulkan.h>
+#include <atomic>
+#include <cstdio>
 #include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <span>
+#include <unordered_map>
 
 
 #include <arena_alloc.hpp>
 #include <file_header.hpp>
 
+#include "cache_backend.hpp"
+#include "compile_memo.hpp"
+#include "compile_history.hpp"
+#include "include_scanner.hpp"
+#include "jobserver.hpp"
+#include "process_pool.hpp"
+#include "shader_compiler.hpp"
+#include "shm_cache.hpp"
+#include "thread_pool.hpp"
 #include "util.hpp"
 
 namespace nh = nlohmann;
 namespace fs = std::filesystem;
 
+struct CachedInclude;
+struct PipelineJob;
+struct StageJob;
+
+// Stages that compile the same file with the same definitions, only the first one is compiled
+// and the others are finished with its result.
+struct IdenticalStages {
+    std::mutex mutex;
+    bool done = false;
+    std::vector<uint32_t> spv;
+    std::string error;
+    std::vector<StageJob*> waiting;
+};
+
+struct StageJob {
+    PipelineJob* pipeline = nullptr;
+    std::string shader_path;
+    VkShaderStageFlagBits stage = {}; // from the file extension or, for a file that holds several stages, the material
+    std::vector<std::pair<std::string, std::string>> definitions = {};
+
+    std::shared_ptr<const CachedInclude> source = nullptr; // loaded before compilation, shared by the stages of one file
+
+    std::vector<uint32_t> spv = {};
+    std::string error         = {}; // set if compilation threw
+    StageInputs inputs        = {}; // the shader first, then the files it may include, found when the pipeline is parsed
+
+    uint64_t predicted_time_us = 0;
+    uint64_t compile_time_us   = 0;
+    bool cache_hit             = false; // the result was reused instead of compiled
+
+    std::shared_ptr<IdenticalStages> identical = nullptr; // set on the stage that is compiled for all of them
+};
+
+struct PipelineJob {
+    CompiledPipeline* pipelinedb; // header only, the stages are appended when it is copied into m_data
+    const CompiledPipeline* previous = nullptr; // the record in the previous output, written again as is if set
+    std::optional<PipelineVariant> variant;     // if it was generated from a "variants" block, the offset is set when it is written
+    std::vector<StageJob> stages;
+    std::atomic<size_t> remaining_stages;
+};
+
 class PipelineDBConstructor {
 public:
-    bool compile_material_file(const char* file_name);
-    bool dump_to_file(const char* file_name);
+    // with use_worker_processes the stages are compiled in thread_count forked processes instead of in this process
+    PipelineDBConstructor(size_t thread_count, bool use_worker_processes = false, const CompilerSettings& settings = {});
+
+    // Streams the materials through parse -> load -> compile -> write stages connected by bounded queues.
+    // Pipelines are written in the order of the material files while later ones are still compiling.
+    // Pipelines whose inputs didn't change since the last build of output_file are copied from it instead.
+    // False if the output couldn't be written or a pipeline failed to build, the other pipelines are written anyway.
+    bool build(std::span<const char* const> material_files, const char* output_file);
+
+    // off: every pipeline is compiled, the previous output is ignored
+    void set_incremental(bool incremental) { m_incremental = incremental; }
+
+    // Only builds the pipelines whose name hashes to shard index out of count, the shards can be
+    // built anywhere and merged with run_linker.
+    void set_shard(size_t index, size_t count) {
+        m_shard_index = index;
+        m_shard_count = count;
+    }
+
+    // Answers without compiling anything whether a build would leave output_file as it is, out_outdated gets
+    // the pipelines it would have to compile. Also fills dependencies() like a build does.
+    bool up_to_date(std::span<const char* const> material_files, const char* output_file, std::vector<std::string>& out_outdated);
+
+    // pipelines of the last build copied from the previous output
+    size_t reused_pipelines() const { return m_reused_pipelines; }
+
+    // caches are looked up in the order they were added, a hit is copied into the ones before it
+    void add_cache(std::unique_ptr<CacheBackend> cache) { m_caches.push_back(std::move(cache)); }
+    const std::vector<std::unique_ptr<CacheBackend>>& caches() const { return m_caches; }
+
+    void enable_shared_cache(const char* name, size_t budget_bytes);
+    const SharedMemoryCache* shared_cache() const { return m_shared_cache.get(); }
+
+    // every material, shader and include file of the last build or up_to_date, sorted
+    std::vector<std::string> dependencies() const;
+
+    // stages of the last build that reused another stage's compile
+    size_t deduplicated_stages() const { return m_deduplicated_stages; }
+
+    // where problems with the materials and shaders are reported, stderr by default
+    void set_error_output(FILE* errors) { m_errors = errors; }
+
+    // replaces the jobserver from the environment, null to take as many jobs as there are threads
+    void set_jobserver(std::unique_ptr<JobServerClient> jobserver) { m_jobserver = std::move(jobserver); }
+
+    void load_compile_history(const char* file_name) { m_history.load(file_name); }
+    bool save_compile_history(const char* file_name) { return m_history.save(file_name); }
 
 private:
-    bool compile_stage(CompiledPipeline* pipelinedb, const std::string& shader_filename, std::vector<std::pair<std::string, std::string>> definitions);
-    CompiledPipeline* compile_pipeline(nh::json::value_type& root_node, fs::path material_dir);
+    // true if an identical stage was already seen, stage is then finished together with it
+    bool defer_to_identical_stage(StageJob& stage, auto&& finish_stage);
+    void load_stage(StageJob& stage);
+    // false if there is no complete database at output_file
+    bool load_previous_output(const char* output_file);
+    // fills in the inputs of the stages
+    void scan_stages(PipelineJob& job);
+    bool find_previous(PipelineJob& job);
+    bool in_shard(const PipelineJob& job) const;
+    Hash fingerprint(const PipelineJob& job) const;
+    // what the compile result of the stage is cached under
+    Hash stage_key(const StageJob& stage) const;
+    void add_dependencies(const PipelineJob& job);
+    void compile_stage(StageJob& stage, size_t worker_id);
+    bool load_cached(const Hash& key, std::vector<uint32_t>& out_spv);
+    void store_cached(const Hash& key, const std::vector<uint32_t>& spv);
+    bool write_pipeline(std::ofstream& file, PipelineJob& job);
+    bool append_stage(CompiledPipeline* pipelinedb, const StageJob& stage);
+    // false if one of its pipelines is malformed, the others are still added to out_jobs
+    bool load_material_file(const char* file_name, vke::ArenaAllocator* arena, std::vector<std::unique_ptr<PipelineJob>>& out_jobs);
+    bool parse_pipeline(PipelineJob& job, nh::json::value_type& root_node, fs::path material_dir, vke::ArenaAllocator* arena);
+    // one pipeline per combination of the values in variants, false if the block is malformed
+    bool expand_variants(const PipelineJob& job, nh::json::value_type& variants, vke::ArenaAllocator* arena, std::vector<std::unique_ptr<PipelineJob>>& out_jobs);
 
 private:
-    vke::ArenaAllocator m_scratch;
-    vke::ArenaAllocator m_data;
-    std::vector<CompiledPipeline*> m_pipelinedbs;
-};
\ No newline at end of file
+    std::unique_ptr<ProcessWorkerPool> m_process_pool; // forked before m_pool starts its threads
+    std::unique_ptr<JobServerClient> m_jobserver;      // null unless we were started by make/ninja with a jobserver
+    ThreadPool m_pool;
+    std::vector<std::unique_ptr<vke::ArenaAllocator>> m_scratch; // one per worker thread, holds the material files and pipeline headers
+    vke::ArenaAllocator m_data; // the pipeline currently being written
+    CompileHistory m_history;
+    std::vector<std::unique_ptr<CacheBackend>> m_caches;
+    std::unique_ptr<SharedMemoryCache> m_shared_cache;
+    IncludeScanner m_scanner;
+    CompileMemo m_compiled; // by hash of the preprocessed stage
+    std::unordered_map<Hash, std::shared_ptr<IdenticalStages>, HashHasher> m_identical_stages; // by file, definitions and kind, only used by the loader
+    size_t m_deduplicated_stages = 0;
+    // the output of the previous build
+    struct PreviousOutput {
+        std::string data;
+        std::unordered_multimap<std::string, const CompiledPipeline*> pipelines; // by name
+    };
+    bool m_incremental = true;
+    size_t m_shard_index = 0;
+    size_t m_shard_count = 1;
+    PreviousOutput m_previous;
+    size_t m_reused_pipelines = 0;
+
+    FILE* m_errors = stderr;
+    std::set<std::string> m_dependencies; // added to by the writer
+    std::vector<std::unique_ptr<ShaderCompilerContext>> m_compiler_contexts; // one per worker thread, also used to hash the inputs in process mode
+};
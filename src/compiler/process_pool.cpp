@@ -0,0 +1,207 @@
+#include "process_pool.hpp"
+
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "socket_io.hpp"
+
+// 256MB, only the touched pages are committed
+const size_t SLAB_SIZE = 1l << 28;
+
+// the only request to the spawner, answered with the u32 pid of the new worker, 0 if it failed,
+// followed by its socket and slab as SCM_RIGHTS
+const uint32_t SPAWN_WORKER = 1;
+
+enum WorkerStatus : uint32_t {
+    WORKER_STATUS_SUCCESS = 0,
+    WORKER_STATUS_ERROR   = 1,
+};
+
+// job:    u32 path_len, u32 stage, u32 source_len, u32 flag_count, path, source, { u32 name_len, u32 value_len, name, value } * flag_count
+//         stage is the VkShaderStageFlagBits to compile source as
+// result: u32 status, u32 size; on success the spirv is at the start of the slab, on error size bytes of message follow
+
+ProcessWorkerPool::ProcessWorkerPool(size_t worker_count, const CompilerSettings& settings) {
+    if (worker_count == 0) worker_count = 1;
+
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) != 0) {
+        throw std::runtime_error("failed to create compile worker socket");
+    }
+
+    m_spawner_pid = fork();
+    if (m_spawner_pid < 0) {
+        throw std::runtime_error("failed to fork compile worker");
+    }
+
+    if (m_spawner_pid == 0) {
+        close(sockets[0]);
+        spawner_main(sockets[1], settings);
+        _exit(0);
+    }
+
+    close(sockets[1]);
+    m_spawner_socket = sockets[0];
+
+    try {
+        for (size_t i = 0; i < worker_count; ++i) {
+            m_workers.push_back(spawn_worker());
+        }
+    } catch (const std::exception&) {
+        for (auto& worker : m_workers) {
+            close_worker(worker);
+        }
+        close(m_spawner_socket);
+        waitpid(m_spawner_pid, nullptr, 0);
+        throw;
+    }
+}
+
+ProcessWorkerPool::~ProcessWorkerPool() {
+    // workers exit once their socket is closed, the spawner once its socket is
+    for (auto& worker : m_workers) {
+        close_worker(worker);
+    }
+
+    close(m_spawner_socket);
+    waitpid(m_spawner_pid, nullptr, 0);
+}
+
+ProcessWorkerPool::Worker ProcessWorkerPool::spawn_worker() {
+    std::lock_guard lock(m_spawner_mutex);
+
+    uint32_t pid;
+    int fds[2]; // the socket and the slab
+    if (!write_u32(m_spawner_socket, SPAWN_WORKER) || !read_u32(m_spawner_socket, pid) || pid == 0 || !recv_fds(m_spawner_socket, fds, 2)) {
+        throw std::runtime_error("failed to start compile worker");
+    }
+
+    void* slab = mmap(nullptr, SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fds[1], 0);
+    close(fds[1]);
+    if (slab == MAP_FAILED) {
+        close(fds[0]);
+        throw std::runtime_error("failed to map compile worker slab");
+    }
+
+    return Worker{.pid = pid_t(pid), .socket = fds[0], .slab = reinterpret_cast<uint8_t*>(slab)};
+}
+
+void ProcessWorkerPool::close_worker(Worker& worker) {
+    if (worker.socket < 0) return;
+
+    close(worker.socket);
+    munmap(worker.slab, SLAB_SIZE);
+    worker.socket = -1;
+    worker.slab   = nullptr;
+}
+
+std::vector<uint32_t> ProcessWorkerPool::compile_glsl(size_t worker_id, const std::string& path, VkShaderStageFlagBits stage, std::string_view source, const std::vector<std::pair<std::string, std::string>>& flags) {
+    Worker& worker = m_workers[worker_id];
+
+    bool sent = write_u32(worker.socket, path.size()) && write_u32(worker.socket, stage) && write_u32(worker.socket, source.size()) && write_u32(worker.socket, flags.size()) &&
+                write_str(worker.socket, path) && write_all(worker.socket, source.data(), source.size());
+    for (auto& [name, value] : flags) {
+        sent = sent && write_u32(worker.socket, name.size()) && write_u32(worker.socket, value.size()) && write_str(worker.socket, name) && write_str(worker.socket, value);
+    }
+
+    uint32_t result[2];
+    bool received = sent && read_all(worker.socket, result, sizeof(result));
+
+    std::string error;
+    if (received && result[0] != WORKER_STATUS_SUCCESS) {
+        received = read_str(worker.socket, error, result[1]);
+    }
+
+    // it most likely crashed on this job and would again, only the jobs after it go to a new worker
+    if (!received) {
+        close_worker(worker);
+        worker = spawn_worker();
+        throw std::runtime_error("compile worker exited unexpectedly while compiling " + path);
+    }
+
+    if (result[0] != WORKER_STATUS_SUCCESS) {
+        throw std::runtime_error(error);
+    }
+
+    auto* spv = reinterpret_cast<const uint32_t*>(worker.slab);
+    return std::vector<uint32_t>(spv, spv + result[1] / sizeof(uint32_t));
+}
+
+void ProcessWorkerPool::spawner_main(int socket, const CompilerSettings& settings) {
+    // the workers are grandchildren of the pool, nobody would wait for them
+    signal(SIGCHLD, SIG_IGN);
+
+    uint32_t request;
+    while (read_u32(socket, request) && request == SPAWN_WORKER) {
+        int sockets[2] = {-1, -1};
+        int slab_fd    = memfd_create("compile_worker_slab", MFD_CLOEXEC);
+        void* slab     = MAP_FAILED;
+        pid_t pid      = -1;
+
+        if (slab_fd >= 0 && ftruncate(slab_fd, SLAB_SIZE) == 0 && socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) == 0) {
+            slab = mmap(nullptr, SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, slab_fd, 0);
+            if (slab != MAP_FAILED) pid = fork();
+        }
+
+        if (pid == 0) {
+            close(socket);
+            close(sockets[0]);
+            close(slab_fd);
+
+            worker_main(sockets[1], reinterpret_cast<uint8_t*>(slab), settings);
+            _exit(0);
+        }
+
+        int fds[2]  = {sockets[0], slab_fd};
+        bool answer = pid > 0 ? write_u32(socket, pid) && send_fds(socket, fds, 2) : write_u32(socket, 0);
+
+        if (slab != MAP_FAILED) munmap(slab, SLAB_SIZE);
+        for (int fd : {sockets[0], sockets[1], slab_fd}) {
+            if (fd >= 0) close(fd);
+        }
+        if (!answer) return;
+    }
+}
+
+void ProcessWorkerPool::worker_main(int socket, uint8_t* slab, const CompilerSettings& settings) {
+    ShaderCompilerContext context(settings);
+
+    while (true) {
+        uint32_t header[4];
+        if (!read_all(socket, header, sizeof(header))) return;
+
+        auto [path_len, stage, source_len, flag_count] = header;
+
+        std::string path, source;
+        if (!read_str(socket, path, path_len) || !read_str(socket, source, source_len)) return;
+
+        std::vector<std::pair<std::string, std::string>> flags(flag_count);
+        for (auto& [name, value] : flags) {
+            uint32_t lens[2];
+            if (!read_all(socket, lens, sizeof(lens)) || !read_str(socket, name, lens[0]) || !read_str(socket, value, lens[1])) return;
+        }
+
+        std::string error;
+        try {
+            auto spv          = context.compile_glsl(path, VkShaderStageFlagBits(stage), source, flags);
+            size_t size_bytes = spv.size() * sizeof(uint32_t);
+
+            if (size_bytes <= SLAB_SIZE) {
+                memcpy(slab, spv.data(), size_bytes);
+                if (!write_u32(socket, WORKER_STATUS_SUCCESS) || !write_u32(socket, size_bytes)) return;
+                continue;
+            }
+
+            error = "compiled SPIR-V does not fit into the worker slab: " + path;
+        } catch (const std::exception& e) {
+            error = e.what();
+        }
+
+        if (!write_u32(socket, WORKER_STATUS_ERROR) || !write_u32(socket, error.size()) || !write_str(socket, error)) return;
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "shader_compiler.hpp"
+
+// Compiles shaders in forked worker processes so shaderc's global state and allocator are not shared between workers.
+// Jobs go to a worker over a unix socket, the worker writes the SPIR-V into a shared memory slab
+// and only sends back a small status message. The workers are forked by a spawner process that is forked along
+// with the pool, so a worker that died can be replaced while the builder's threads are running.
+class ProcessWorkerPool {
+public:
+    // must be created before any other threads are started
+    ProcessWorkerPool(size_t worker_count, const CompilerSettings& settings = {});
+    ~ProcessWorkerPool();
+
+    size_t worker_count() const { return m_workers.size(); }
+    pid_t worker_pid(size_t worker_id) const { return m_workers[worker_id].pid; }
+
+    // Only one thread may use a given worker at a time. If the worker dies on the job, the job fails
+    // and the worker is replaced for the next one.
+    std::vector<uint32_t> compile_glsl(size_t worker_id, const std::string& path, VkShaderStageFlagBits stage, std::string_view source, const std::vector<std::pair<std::string, std::string>>& flags);
+
+    ProcessWorkerPool(const ProcessWorkerPool&)            = delete;
+    ProcessWorkerPool& operator=(const ProcessWorkerPool&) = delete;
+
+private:
+    struct Worker {
+        pid_t pid;
+        int socket;
+        uint8_t* slab; // shared with the worker process
+    };
+
+    Worker spawn_worker();
+    void close_worker(Worker& worker);
+
+    static void spawner_main(int socket, const CompilerSettings& settings);
+    static void worker_main(int socket, uint8_t* slab, const CompilerSettings& settings);
+
+private:
+    pid_t m_spawner_pid;
+    int m_spawner_socket;
+    std::mutex m_spawner_mutex;
+    std::vector<Worker> m_workers;
+};
@@ -0,0 +1,155 @@
+#include "remote_cache.hpp"
+
+#include <cstdio>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "socket_io.hpp"
+
+// get: u8 'G', key; answered with u32 size (0 for a miss) followed by size bytes of spirv
+// put: u8 'P', key, u32 size, size bytes of spirv; not answered
+const uint8_t OP_GET = 'G';
+const uint8_t OP_PUT = 'P';
+
+const size_t MAX_PENDING_UPLOADS = 1024;
+const uint32_t MAX_SPV_SIZE      = 64 << 20; // anything bigger is a broken peer rather than a shader
+const int REMOTE_TIMEOUT_MS      = 2000;
+
+static int connect_remote(const char* socket_path) {
+    int socket = connect_unix_socket(socket_path);
+    if (socket >= 0 && !set_socket_timeout(socket, REMOTE_TIMEOUT_MS)) {
+        close(socket);
+        return -1;
+    }
+    return socket;
+}
+
+RemoteCacheBackend::RemoteCacheBackend(const char* socket_path) : m_socket_path(socket_path), m_uploads(MAX_PENDING_UPLOADS) {
+    int fetch_socket = connect_remote(socket_path);
+    m_store_socket   = connect_remote(socket_path);
+
+    if (fetch_socket < 0 || m_store_socket < 0) {
+        if (fetch_socket >= 0) close(fetch_socket);
+        if (m_store_socket >= 0) close(m_store_socket);
+        throw std::runtime_error(std::string("failed to connect to remote cache: ") + socket_path);
+    }
+    m_idle_sockets.push_back(fetch_socket);
+
+    m_uploader = std::thread([this] { upload_loop(); });
+}
+
+RemoteCacheBackend::~RemoteCacheBackend() {
+    m_uploads.close();
+    m_uploader.join();
+
+    for (int socket : m_idle_sockets) close(socket);
+    if (m_store_socket >= 0) close(m_store_socket);
+}
+
+int RemoteCacheBackend::take_connection() {
+    if (m_lost) return -1;
+    {
+        std::lock_guard lock(m_idle_mutex);
+        if (!m_idle_sockets.empty()) {
+            int socket = m_idle_sockets.back();
+            m_idle_sockets.pop_back();
+            return socket;
+        }
+    }
+    return connect_remote(m_socket_path.c_str());
+}
+
+void RemoteCacheBackend::return_connection(int socket) {
+    std::lock_guard lock(m_idle_mutex);
+    m_idle_sockets.push_back(socket);
+}
+
+bool RemoteCacheBackend::fetch(const Hash& key, std::vector<uint32_t>& out_spv) {
+    int socket = take_connection();
+    if (socket < 0) return false;
+
+    uint32_t size;
+    bool ok = write_all(socket, &OP_GET, 1) && write_all(socket, key.data(), key.size()) && read_u32(socket, size) &&
+              size % sizeof(uint32_t) == 0 && size <= MAX_SPV_SIZE;
+    if (ok && size > 0) {
+        out_spv.resize(size / sizeof(uint32_t));
+        ok = read_all(socket, out_spv.data(), size);
+    }
+
+    if (!ok) {
+        // the server went away or stopped answering, every further lookup is a miss and compiles locally
+        if (!m_lost.exchange(true)) fprintf(stderr, "lost connection to remote cache\n");
+        close(socket);
+        return false;
+    }
+
+    return_connection(socket);
+    return size > 0;
+}
+
+void RemoteCacheBackend::store(const Hash& key, std::span<const uint32_t> spv) {
+    // dropping an upload only costs a future miss
+    m_uploads.try_push({key, std::vector<uint32_t>(spv.begin(), spv.end())});
+}
+
+void RemoteCacheBackend::upload_loop() {
+    while (auto upload = m_uploads.pop()) {
+        auto& [key, spv] = *upload;
+        if (m_store_socket < 0) continue;
+
+        bool ok = write_all(m_store_socket, &OP_PUT, 1) && write_all(m_store_socket, key.data(), key.size()) &&
+                  write_u32(m_store_socket, spv.size() * sizeof(uint32_t)) && write_all(m_store_socket, spv.data(), spv.size() * sizeof(uint32_t));
+        if (!ok) {
+            close(m_store_socket);
+            m_store_socket = -1;
+        }
+    }
+}
+
+static void serve_connection(int socket, DirectoryCacheBackend* cache) {
+    std::vector<uint32_t> spv;
+
+    while (true) {
+        uint8_t op;
+        Hash key;
+        if (!read_all(socket, &op, 1) || !read_all(socket, key.data(), key.size())) break;
+
+        if (op == OP_GET) {
+            uint32_t size = cache->load(key, spv) ? spv.size() * sizeof(uint32_t) : 0;
+            if (!write_u32(socket, size) || !write_all(socket, spv.data(), size)) break;
+        } else if (op == OP_PUT) {
+            uint32_t size;
+            if (!read_u32(socket, size) || size % sizeof(uint32_t) != 0 || size > MAX_SPV_SIZE) break;
+
+            spv.resize(size / sizeof(uint32_t));
+            if (!read_all(socket, spv.data(), size)) break;
+
+            cache->store(key, spv);
+        } else {
+            break;
+        }
+    }
+
+    close(socket);
+}
+
+int run_cache_server(const char* socket_path, const char* directory) {
+    DirectoryCacheBackend cache(directory, DEFAULT_CACHE_MAX_MB << 20);
+
+    int listen_socket = listen_unix_socket(socket_path);
+    if (listen_socket < 0) {
+        fprintf(stderr, "failed to listen on %s\n", socket_path);
+        return 1;
+    }
+
+    printf("serving %s on %s\n", directory, socket_path);
+    fflush(stdout);
+
+    while (true) {
+        int socket = accept(listen_socket, nullptr, nullptr);
+        if (socket < 0) continue;
+
+        std::thread(serve_connection, socket, &cache).detach();
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "bounded_queue.hpp"
+#include "cache_backend.hpp"
+
+// Cache served by another process over a unix socket, see run_cache_server.
+// Stores are queued and uploaded by a background thread so they never hold up a compile. Lookups that run at the
+// same time each use a connection of their own, and a server that stops answering turns every lookup into a miss
+// after a timeout so the stages are compiled locally.
+class RemoteCacheBackend : public CacheBackend {
+public:
+    // throws if the server can't be reached
+    RemoteCacheBackend(const char* socket_path);
+    // waits for the queued uploads
+    ~RemoteCacheBackend() override;
+
+    const char* name() const override { return "remote cache"; }
+
+    void store(const Hash& key, std::span<const uint32_t> spv) override;
+
+protected:
+    bool fetch(const Hash& key, std::vector<uint32_t>& out_spv) override;
+
+private:
+    // an idle connection or a new one, -1 once the server has been lost
+    int take_connection();
+    void return_connection(int socket);
+
+    void upload_loop();
+
+private:
+    std::string m_socket_path;
+
+    std::mutex m_idle_mutex;
+    std::vector<int> m_idle_sockets;
+    std::atomic<bool> m_lost = false;
+
+    int m_store_socket;
+
+    BoundedQueue<std::pair<Hash, std::vector<uint32_t>>> m_uploads;
+    std::thread m_uploader;
+};
+
+// Serves a DirectoryCacheBackend on a unix socket until killed, a stand-in for a shared cache server.
+int run_cache_server(const char* socket_path, const char* directory);
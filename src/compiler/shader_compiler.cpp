@@ -2,13 +2,17 @@
 
 #include <filesystem>
 #include <fstream>
-#include <shaderc/shaderc.hpp>
 #include <string>
+#include <unordered_set>
 
 
 
 #include <arena_alloc.hpp>
 
+#include "include_cache.hpp"
+#include "unused_functions.hpp"
+#include "vk_utlls.hpp"
+
 using vke::ArenaAllocator;
 namespace fs = std::filesystem;
 
@@ -34,33 +38,106 @@ std::string_view read_file(vke::ArenaAllocator* arena, const char* name) {
     
 }
 
+std::string read_file(const char* name) {
+    std::ifstream file(name, std::ios::ate);
+    if (!file.is_open()) {
+        char error[120];
+
+        snprintf(error, sizeof(error), "failed to open file: %s", name);
+
+        throw std::runtime_error(error);
+    }
+    std::string data(static_cast<size_t>(file.tellg()), '\0');
+
+    file.seekg(0);
+    file.read(data.data(), data.size());
+    return data;
+}
+
 class ShadercIncluder : public shaderc::CompileOptions::IncluderInterface {
 public:
-    ShadercIncluder(ArenaAllocator* _arena) {
-        m_arena = _arena;
+    ShadercIncluder(ArenaAllocator* _arena, std::vector<IncludedFile>* _included_files) {
+        m_arena          = _arena;
+        m_included_files = _included_files;
     }
 
     ArenaAllocator* m_arena;
+    std::vector<IncludedFile>* m_included_files;
+    SharedMemoryCache* m_shared_cache = nullptr;
 
-    shaderc_include_result* GetInclude(const char* requested_source, shaderc_include_type type, const char* requesting_source, size_t include_depth) override {
-        if (type == shaderc_include_type_standard) return nullptr;
+    // files of the current compilation that don't have to be read again, and every macro #undef'd so far
+    std::unordered_set<const CachedInclude*> m_skippable;
+    std::unordered_set<std::string> m_undefined_macros;
 
-        fs::path path = fs::path(requesting_source).parent_path() / requested_source;
+    void begin_compilation(std::string_view source) {
+        m_skippable.clear();
+        m_undefined_macros.clear();
+
+        // the whole main file is looked at, so an #undef after an include is seen as well
+        if (source.find("undef") != std::string_view::npos) {
+            for (auto& macro : analyze_include_guard(source).undefined_macros) m_undefined_macros.insert(macro);
+        }
+    }
 
-        auto content = read_file(m_arena, path.c_str());
+    // keeps the cached file alive until shaderc is done with it
+    struct IncludeResult {
+        shaderc_include_result result;
+        std::shared_ptr<const CachedInclude> file;
+        std::string error;
+    };
+
+    shaderc_include_result* GetInclude(const char* requested_source, shaderc_include_type type, const char* requesting_source, size_t include_depth) override {
+        IncludeCache& include_cache = IncludeCache::process_cache();
+
+        // the path as it was found, it ends up in the debug info
+        std::string path;
+        if (!include_cache.resolve(requesting_source, requested_source, type == shaderc_include_type_relative, path)) {
+            // shaderc reports an empty source name with the content as the error
+            auto* include   = new IncludeResult{.result = {}, .file = nullptr, .error = std::string("cannot find include file: ") + requested_source};
+            include->result = shaderc_include_result{
+                .source_name        = "",
+                .source_name_length = 0,
+                .content            = include->error.data(),
+                .content_length     = include->error.size(),
+                .user_data          = include,
+            };
+            return &include->result;
+        }
+
+        auto file = include_cache.get(path, m_shared_cache);
+
+        // a file guarded by #pragma once or an include guard only expands to nothing the second time
+        const IncludeGuardInfo& guard = file->guard;
+        bool skip = m_skippable.contains(file.get()) && (guard.pragma_once || !m_undefined_macros.contains(guard.guard_macro));
+
+        if (!skip) {
+            for (auto& macro : guard.undefined_macros) m_undefined_macros.insert(macro);
+            if (guard.pragma_once || !guard.guard_macro.empty()) m_skippable.insert(file.get());
+        }
 
         size_t pathc_len;
         const char* pathc = m_arena->create_str_copy(path.c_str(), &pathc_len);
 
-        return m_arena->create_copy(shaderc_include_result{
+        m_included_files->push_back(IncludedFile{
+            .path         = std::string_view(pathc, pathc_len),
+            .content      = file->content,
+            .content_hash = file->content_hash,
+            .file         = file,
+        });
+
+        auto* include   = new IncludeResult{.result = {}, .file = std::move(file), .error = {}};
+        include->result = shaderc_include_result{
             .source_name        = pathc,
             .source_name_length = pathc_len,
-            .content            = content.begin(),
-            .content_length     = content.size(),
-        });
+            .content            = skip ? "" : include->file->content.data(),
+            .content_length     = skip ? 0 : include->file->content.size(),
+            .user_data          = include,
+        };
+        return &include->result;
     }
 
     void ReleaseInclude(shaderc_include_result* data) override {
+        delete static_cast<IncludeResult*>(data->user_data);
     }
 };
 
@@ -118,6 +195,7 @@ void add_shader_kind_macro_def(shaderc::CompileOptions& options, shaderc_shader_
 // Function to compile GLSL shader
 shaderc::SpvCompilationResult compileGLSL(const std::string& file_path, shaderc_shader_kind kind = shaderc_glsl_infer_from_source) {
     ArenaAllocator arena;
+    std::vector<IncludedFile> included_files;
 
     shaderc::Compiler compiler;
     shaderc::CompileOptions options;
@@ -125,7 +203,7 @@ shaderc::SpvCompilationResult compileGLSL(const std::string& file_path, shaderc_
     options.SetTargetSpirv(shaderc_spirv_version_1_5);
 
     // options.SetOptimizationLevel(shaderc_optimization_level_performance);
-    options.SetIncluder(std::make_unique<ShadercIncluder>(&arena));
+    options.SetIncluder(std::make_unique<ShadercIncluder>(&arena, &included_files));
 
     add_shader_kind_macro_def(options, kind);
 
@@ -140,43 +218,118 @@ shaderc::SpvCompilationResult compileGLSL(const std::string& file_path, shaderc_
     return result;
 }
 
-shaderc_shader_kind inferShaderType(const std::string& filePath) {
-    if (filePath.ends_with(".frag") || filePath.ends_with(".fsh")) return shaderc_glsl_fragment_shader;
-    if (filePath.ends_with(".vert") || filePath.ends_with(".vsh")) return shaderc_glsl_vertex_shader;
-    if (filePath.ends_with(".geom")) return shaderc_glsl_geometry_shader;
-    if (filePath.ends_with(".comp")) return shaderc_glsl_compute_shader;
-    if (filePath.ends_with(".tesc")) return shaderc_glsl_tess_control_shader;
-    if (filePath.ends_with(".tese")) return shaderc_glsl_tess_evaluation_shader;
-    if (filePath.ends_with(".mesh")) return shaderc_glsl_mesh_shader;
-    if (filePath.ends_with(".task")) return shaderc_glsl_task_shader;
-
-    throw std::runtime_error("Unknown shader file extension: " + filePath);
+static shaderc_shader_kind shader_kind(VkShaderStageFlagBits stage) {
+    switch (stage) {
+    case VK_SHADER_STAGE_VERTEX_BIT: return shaderc_glsl_vertex_shader;
+    case VK_SHADER_STAGE_FRAGMENT_BIT: return shaderc_glsl_fragment_shader;
+    case VK_SHADER_STAGE_GEOMETRY_BIT: return shaderc_glsl_geometry_shader;
+    case VK_SHADER_STAGE_COMPUTE_BIT: return shaderc_glsl_compute_shader;
+    case VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT: return shaderc_glsl_tess_control_shader;
+    case VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT: return shaderc_glsl_tess_evaluation_shader;
+    case VK_SHADER_STAGE_MESH_BIT_EXT: return shaderc_glsl_mesh_shader;
+    case VK_SHADER_STAGE_TASK_BIT_EXT: return shaderc_glsl_task_shader;
+    default: throw std::runtime_error("Unsupported shader stage: " + std::to_string(stage));
+    }
 }
 
-std::vector<uint32_t> compile_glsl(const std::string& file_path, const std::vector<std::pair<std::string, std::string>>& flags) {
-    ArenaAllocator arena;
+ShaderCompilerContext::ShaderCompilerContext(const CompilerSettings& settings) : m_settings(settings) {
+    m_base_options.SetTargetSpirv(shaderc_spirv_version_1_5);
 
-    shaderc::Compiler compiler;
-    shaderc::CompileOptions options;
+    // m_base_options.SetOptimizationLevel(shaderc_optimization_level_performance);
+    // copies of the options keep calling into this includer
+    auto includer = std::make_unique<ShadercIncluder>(&m_arena, &m_included_files);
+    m_includer    = includer.get();
+    m_base_options.SetIncluder(std::move(includer));
 
-    options.SetTargetSpirv(shaderc_spirv_version_1_5);
+    if (m_settings.debug_info) m_base_options.SetGenerateDebugInfo();
 
-    // options.SetOptimizationLevel(shaderc_optimization_level_performance);
-    options.SetIncluder(std::make_unique<ShadercIncluder>(&arena));
+    m_options_key = make_options_key(m_settings);
+}
 
-    options.SetGenerateDebugInfo();
+std::string ShaderCompilerContext::make_options_key(const CompilerSettings& settings) {
+    // shaderc has no version query of its own, the SPIR-V version it was built for is the closest thing
+    unsigned int spv_version, spv_revision;
+    shaderc_get_spv_version(&spv_version, &spv_revision);
 
-    auto source = read_file(&arena, file_path.c_str());
+    bool strips_unused_functions = settings.strip_unused_functions && !settings.debug_info;
+    return std::string("spirv-target=1.5 ") + (settings.debug_info ? "debug-info " : "") + "optimization=none " +
+           (strips_unused_functions ? "strip-unused-functions " : "") + "shaderc-spv=" + std::to_string(spv_version) + "." + std::to_string(spv_revision);
+}
 
+void ShaderCompilerContext::set_shared_cache(SharedMemoryCache* shared_cache) {
+    m_includer->m_shared_cache = shared_cache;
+}
+
+shaderc::CompileOptions ShaderCompilerContext::make_options(shaderc_shader_kind kind, const std::vector<std::pair<std::string, std::string>>& flags) const {
+    shaderc::CompileOptions options(m_base_options);
+
+    add_shader_kind_macro_def(options, kind);
     for (auto& [name, definition] : flags) {
         options.AddMacroDefinition(name, definition);
     }
 
-    shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(source.begin(), source.size(), inferShaderType(file_path), file_path.c_str(), "main", options);
+    return options;
+}
+
+std::string ShaderCompilerContext::preprocess(const std::string& file_path, VkShaderStageFlagBits stage, std::string_view source, const std::vector<std::pair<std::string, std::string>>& flags) {
+    m_arena.reset();
+    m_included_files.clear();
+    m_includer->begin_compilation(source);
+
+    shaderc_shader_kind kind        = shader_kind(stage);
+    shaderc::CompileOptions options = make_options(kind, flags);
+
+    auto result = m_compiler.PreprocessGlsl(source.data(), source.size(), kind, file_path.c_str(), options);
+
+    if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
+        throw std::runtime_error("Shader compilation failed: " + std::string(result.GetErrorMessage()));
+    }
+
+    std::string_view preprocessed(result.begin(), result.end() - result.begin());
+    return strips_unused_functions() ? strip_unused_functions(preprocessed) : std::string(preprocessed);
+}
+
+Hash ShaderCompilerContext::hash_preprocessed(const std::string& file_path, VkShaderStageFlagBits stage, std::string_view preprocessed) const {
+    Hasher hasher;
+    hasher.update_str(m_options_key);
+    hasher.update_u64(stage);
+    // the file name ends up in the debug info
+    hasher.update_str(file_path);
+    hasher.update_str(preprocessed);
+    return hasher.finish();
+}
+
+std::vector<uint32_t> ShaderCompilerContext::compile_glsl(const std::string& file_path, const std::vector<std::pair<std::string, std::string>>& flags) {
+    m_arena.reset();
+    m_included_files.clear();
+
+    auto source = read_file(&m_arena, file_path.c_str());
+
+    return compile_source(file_path, shader_kind(infer_shader_stage(file_path)), source, flags);
+}
+
+std::vector<uint32_t> ShaderCompilerContext::compile_glsl(const std::string& file_path, VkShaderStageFlagBits stage, std::string_view source, const std::vector<std::pair<std::string, std::string>>& flags) {
+    m_arena.reset();
+    m_included_files.clear();
+
+    return compile_source(file_path, shader_kind(stage), source, flags);
+}
+
+std::vector<uint32_t> ShaderCompilerContext::compile_source(const std::string& file_path, shaderc_shader_kind kind, std::string_view source, const std::vector<std::pair<std::string, std::string>>& flags) {
+    m_includer->begin_compilation(source);
+
+    shaderc::CompileOptions options = make_options(kind, flags);
+
+    shaderc::SpvCompilationResult result = m_compiler.CompileGlslToSpv(source.data(), source.size(), kind, file_path.c_str(), "main", options);
 
     if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
         throw std::runtime_error("Shader compilation failed: " + std::string(result.GetErrorMessage()));
     }
 
     return std::vector<uint32_t>(result.begin(), result.end());
-}
\ No newline at end of file
+}
+
+std::vector<uint32_t> compile_glsl(const std::string& file_path, const std::vector<std::pair<std::string, std::string>>& flags) {
+    ShaderCompilerContext context;
+    return context.compile_glsl(file_path, flags);
+}
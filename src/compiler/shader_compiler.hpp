@@ -1,7 +1,86 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <shaderc/shaderc.hpp>
+#include <vulkan/vulkan.h>
 
-std::vector<uint32_t> compile_glsl(const std::string& path, const std::vector<std::pair<std::string, std::string>>& flags);
\ No newline at end of file
+#include <arena_alloc.hpp>
+
+#include "hash.hpp"
+
+class SharedMemoryCache;
+struct CachedInclude;
+
+struct IncludedFile {
+    std::string_view path;
+    std::string_view content;
+    Hash content_hash;
+    std::shared_ptr<const CachedInclude> file; // owns content
+};
+
+class ShadercIncluder;
+
+// what every compilation of a build is set up with, part of the options key
+struct CompilerSettings {
+    bool debug_info             = true;  // the SPIR-V carries the file names and the source text as written
+    bool strip_unused_functions = false; // from the preprocessed text, only without debug info which would lose them
+};
+
+// Long lived compiler state; every compile only clones the prebuilt options and adds its own macros.
+// Besides its flags every compilation has the macro of its stage defined, VERTEX_SHADER, FRAGMENT_SHADER and so on,
+// so one file can hold several stages. Not thread safe, use one context per thread.
+class ShaderCompilerContext {
+public:
+    ShaderCompilerContext(const CompilerSettings& settings = {});
+
+    // the stage is inferred from the file extension
+    std::vector<uint32_t> compile_glsl(const std::string& path, const std::vector<std::pair<std::string, std::string>>& flags);
+    // source is the already loaded contents of path
+    std::vector<uint32_t> compile_glsl(const std::string& path, VkShaderStageFlagBits stage, std::string_view source, const std::vector<std::pair<std::string, std::string>>& flags);
+
+    // Runs only the preprocessor, the result compiles to the same code as the source with flags does.
+    // With strips_unused_functions the functions main doesn't reach are left out so the compiler doesn't parse them.
+    std::string preprocess(const std::string& path, VkShaderStageFlagBits stage, std::string_view source, const std::vector<std::pair<std::string, std::string>>& flags);
+
+    // Hash of everything the compilation of preprocessed source of path depends on: the text, the stage
+    // and the compile options. Translation units that only differ in macros they don't use hash the same.
+    Hash hash_preprocessed(const std::string& path, VkShaderStageFlagBits stage, std::string_view preprocessed) const;
+
+    // describes the compile options, part of every hash of the compile inputs
+    const std::string& options_key() const { return m_options_key; }
+    static std::string make_options_key(const CompilerSettings& settings);
+
+    // Whether preprocessed text can be compiled in place of the source. Not with debug info, the SPIR-V would
+    // carry the preprocessed text instead of the source as it was written.
+    bool compiles_preprocessed() const { return !m_settings.debug_info; }
+    bool strips_unused_functions() const { return m_settings.strip_unused_functions && compiles_preprocessed(); }
+    const CompilerSettings& settings() const { return m_settings; }
+
+    // include files are looked up in and added to the cache
+    void set_shared_cache(SharedMemoryCache* shared_cache);
+
+    // the files included by the last compilation or preprocess, valid until the next call
+    const std::vector<IncludedFile>& included_files() const { return m_included_files; }
+
+    ShaderCompilerContext(const ShaderCompilerContext&)            = delete;
+    ShaderCompilerContext& operator=(const ShaderCompilerContext&) = delete;
+
+private:
+    shaderc::CompileOptions make_options(shaderc_shader_kind kind, const std::vector<std::pair<std::string, std::string>>& flags) const;
+    std::vector<uint32_t> compile_source(const std::string& path, shaderc_shader_kind kind, std::string_view source, const std::vector<std::pair<std::string, std::string>>& flags);
+
+private:
+    CompilerSettings m_settings;
+    vke::ArenaAllocator m_arena; // source and include contents of the current compilation
+    std::vector<IncludedFile> m_included_files;
+    std::string m_options_key;
+    ShadercIncluder* m_includer; // owned by m_base_options
+    shaderc::Compiler m_compiler;
+    shaderc::CompileOptions m_base_options;
+};
+
+std::vector<uint32_t> compile_glsl(const std::string& path, const std::vector<std::pair<std::string, std::string>>& flags);
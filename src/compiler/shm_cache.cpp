@@ -0,0 +1,210 @@
+#include "shm_cache.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdexcept>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const uint64_t SHM_CACHE_MAGIC  = 0x5348434143484531;
+const uint32_t SHARD_COUNT      = 64;
+const uint32_t WAYS             = 8;
+const size_t AVERAGE_VALUE_SIZE = 8 * 1024;
+const size_t ALIGNMENT          = 64;
+
+struct ShmCacheEntry {
+    Hash key;
+    uint64_t offset;
+    uint32_t size;
+    uint32_t valid;
+    uint64_t last_used;
+};
+
+struct ShmCacheHeader {
+    std::atomic<uint64_t> magic; // written last by the process that set up the segment
+    uint32_t shard_count;
+    uint32_t set_count;          // per shard, every set has WAYS entries
+    uint64_t shard_stride;
+    uint64_t data_size;          // per shard
+};
+
+struct ShmCacheShard {
+    pthread_mutex_t mutex;
+    uint64_t cursor;
+    uint64_t tick;
+    ShmCacheEntry entries[]; // set_count * WAYS, followed by data_size bytes of values
+};
+
+static size_t align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static uint64_t key_bits(const Hash& key, int offset) {
+    uint64_t bits;
+    memcpy(&bits, key.data() + offset, sizeof(bits));
+    return bits;
+}
+
+SharedMemoryCache::SharedMemoryCache(const char* name, size_t budget_bytes) {
+    std::string shm_name = name[0] == '/' ? name : std::string("/") + name;
+
+    int fd = shm_open(shm_name.c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        throw std::runtime_error("failed to open shared memory cache: " + shm_name);
+    }
+
+    // Whoever holds the lock sets the segment up if that hasn't been finished. The lock goes away with a process
+    // that dies halfway through and the magic is written last, so the next process simply starts over.
+    while (flock(fd, LOCK_EX) != 0 && errno == EINTR) {}
+
+    auto fail = [&](const char* message) {
+        flock(fd, LOCK_UN);
+        close(fd);
+        throw std::runtime_error(message + shm_name);
+    };
+
+    struct stat st;
+    uint64_t magic = 0;
+    if (fstat(fd, &st) != 0) fail("failed to open shared memory cache: ");
+
+    bool initialized = size_t(st.st_size) >= sizeof(ShmCacheHeader) && pread(fd, &magic, sizeof(magic), 0) == sizeof(magic) && magic == SHM_CACHE_MAGIC;
+
+    // the budget of the process that set it up wins, anything left by a crashed one is zeroed
+    if (!initialized && (ftruncate(fd, 0) != 0 || ftruncate(fd, budget_bytes) != 0)) fail("failed to size shared memory cache: ");
+    m_size = initialized ? st.st_size : budget_bytes;
+
+    void* base = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) fail("failed to map shared memory cache: ");
+    m_header = reinterpret_cast<ShmCacheHeader*>(base);
+
+    if (!initialized) {
+        size_t shard_stride = (m_size - align_up(sizeof(ShmCacheHeader), ALIGNMENT)) / SHARD_COUNT / ALIGNMENT * ALIGNMENT;
+        size_t set_count    = std::max<size_t>(1, shard_stride / AVERAGE_VALUE_SIZE / WAYS);
+        size_t index_size   = align_up(sizeof(ShmCacheShard) + set_count * WAYS * sizeof(ShmCacheEntry), ALIGNMENT);
+        if (shard_stride <= index_size) {
+            munmap(base, m_size);
+            fail("shared memory cache budget is too small: ");
+        }
+
+        m_header->shard_count  = SHARD_COUNT;
+        m_header->set_count    = set_count;
+        m_header->shard_stride = shard_stride;
+        m_header->data_size    = shard_stride - index_size;
+
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+
+        for (uint32_t i = 0; i < SHARD_COUNT; ++i) {
+            auto* shard = reinterpret_cast<ShmCacheShard*>(reinterpret_cast<char*>(base) + align_up(sizeof(ShmCacheHeader), ALIGNMENT) + i * shard_stride);
+            pthread_mutex_init(&shard->mutex, &attr);
+            // the rest of the shard is already zero filled by ftruncate
+        }
+
+        pthread_mutexattr_destroy(&attr);
+
+        m_header->magic.store(SHM_CACHE_MAGIC, std::memory_order_release);
+    }
+
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+SharedMemoryCache::~SharedMemoryCache() {
+    // the segment outlives us so the next compiler process finds it warm
+    munmap(m_header, m_size);
+}
+
+ShmCacheShard* SharedMemoryCache::shard_for(const Hash& key) const {
+    size_t index = key_bits(key, 0) % m_header->shard_count;
+
+    auto* base = reinterpret_cast<char*>(m_header) + align_up(sizeof(ShmCacheHeader), ALIGNMENT);
+    return reinterpret_cast<ShmCacheShard*>(base + index * m_header->shard_stride);
+}
+
+void SharedMemoryCache::lock(ShmCacheShard* shard) {
+    if (pthread_mutex_lock(&shard->mutex) == EOWNERDEAD) {
+        // a process died while holding the lock, the shard may be half written so forget everything in it
+        memset(shard->entries, 0, m_header->set_count * WAYS * sizeof(ShmCacheEntry));
+        shard->cursor = 0;
+        pthread_mutex_consistent(&shard->mutex);
+    }
+}
+
+void SharedMemoryCache::unlock(ShmCacheShard* shard) {
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+bool SharedMemoryCache::get(const Hash& key, std::vector<char>& out_value) {
+    ShmCacheShard* shard = shard_for(key);
+    ShmCacheEntry* set   = shard->entries + key_bits(key, 8) % m_header->set_count * WAYS;
+    char* data           = reinterpret_cast<char*>(shard->entries + m_header->set_count * WAYS);
+
+    lock(shard);
+
+    for (uint32_t i = 0; i < WAYS; ++i) {
+        ShmCacheEntry& entry = set[i];
+        if (!entry.valid || entry.key != key) continue;
+
+        entry.last_used = ++shard->tick;
+        out_value.assign(data + entry.offset, data + entry.offset + entry.size);
+
+        unlock(shard);
+        m_hits++;
+        return true;
+    }
+
+    unlock(shard);
+    m_misses++;
+    return false;
+}
+
+void SharedMemoryCache::put(const Hash& key, std::string_view value) {
+    ShmCacheShard* shard = shard_for(key);
+    ShmCacheEntry* set   = shard->entries + key_bits(key, 8) % m_header->set_count * WAYS;
+    char* data           = reinterpret_cast<char*>(shard->entries + m_header->set_count * WAYS);
+    size_t entry_count   = m_header->set_count * WAYS;
+
+    if (value.size() > m_header->data_size / 4) return; // would evict most of the shard
+
+    lock(shard);
+
+    // pick an empty way, an existing entry for the key or the least recently used one
+    ShmCacheEntry* target = &set[0];
+    for (uint32_t i = 0; i < WAYS; ++i) {
+        ShmCacheEntry& entry = set[i];
+        if (entry.valid && entry.key == key) {
+            unlock(shard);
+            return;
+        }
+        if (!entry.valid || (target->valid && entry.last_used < target->last_used)) target = &entry;
+    }
+    target->valid = false;
+
+    if (shard->cursor + value.size() > m_header->data_size) shard->cursor = 0;
+    uint64_t begin = shard->cursor;
+    uint64_t end   = begin + value.size();
+
+    // everything the new value overwrites in the ring is evicted
+    for (size_t i = 0; i < entry_count; ++i) {
+        ShmCacheEntry& entry = shard->entries[i];
+        if (entry.valid && entry.offset < end && begin < entry.offset + entry.size) entry.valid = false;
+    }
+
+    memcpy(data + begin, value.data(), value.size());
+    shard->cursor = align_up(end, 8);
+
+    target->key       = key;
+    target->offset    = begin;
+    target->size      = value.size();
+    target->last_used = ++shard->tick;
+    target->valid     = true;
+
+    unlock(shard);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "hash.hpp"
+
+struct ShmCacheHeader;
+struct ShmCacheShard;
+
+// Fixed size key/value cache in a POSIX shared memory segment, shared by every compiler process that opens the same name.
+// Keys are split over shards that each have their own process shared mutex, a small set associative index
+// and a ring buffer for the values; new values overwrite the oldest ones once a shard's ring is full.
+class SharedMemoryCache {
+public:
+    SharedMemoryCache(const char* name, size_t budget_bytes);
+    ~SharedMemoryCache();
+
+    bool get(const Hash& key, std::vector<char>& out_value);
+    void put(const Hash& key, std::string_view value);
+
+    size_t hits() const { return m_hits; }
+    size_t misses() const { return m_misses; }
+
+    SharedMemoryCache(const SharedMemoryCache&)            = delete;
+    SharedMemoryCache& operator=(const SharedMemoryCache&) = delete;
+
+private:
+    ShmCacheShard* shard_for(const Hash& key) const;
+    void lock(ShmCacheShard* shard);
+    void unlock(ShmCacheShard* shard);
+
+private:
+    ShmCacheHeader* m_header = nullptr;
+    size_t m_size            = 0;
+
+    std::atomic<size_t> m_hits   = 0;
+    std::atomic<size_t> m_misses = 0;
+};
@@ -0,0 +1,132 @@
+#include "socket_io.hpp"
+
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+bool write_all(int fd, const void* data, size_t size) {
+    auto* cursor = reinterpret_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t written = send(fd, cursor, size, MSG_NOSIGNAL);
+        if (written <= 0) return false;
+        cursor += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool read_all(int fd, void* data, size_t size) {
+    auto* cursor = reinterpret_cast<char*>(data);
+    while (size > 0) {
+        ssize_t received = recv(fd, cursor, size, 0);
+        if (received <= 0) return false;
+        cursor += received;
+        size -= received;
+    }
+    return true;
+}
+
+bool send_fds(int socket, const int* fds, size_t count) {
+    char byte = 0;
+    iovec iov{.iov_base = &byte, .iov_len = 1};
+
+    std::vector<char> control(CMSG_SPACE(count * sizeof(int)));
+    msghdr message         = {};
+    message.msg_iov        = &iov;
+    message.msg_iovlen     = 1;
+    message.msg_control    = control.data();
+    message.msg_controllen = control.size();
+
+    cmsghdr* header    = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type  = SCM_RIGHTS;
+    header->cmsg_len   = CMSG_LEN(count * sizeof(int));
+    memcpy(CMSG_DATA(header), fds, count * sizeof(int));
+
+    return sendmsg(socket, &message, MSG_NOSIGNAL) == 1;
+}
+
+bool recv_fds(int socket, int* out_fds, size_t count) {
+    char byte;
+    iovec iov{.iov_base = &byte, .iov_len = 1};
+
+    std::vector<char> control(CMSG_SPACE(count * sizeof(int)));
+    msghdr message         = {};
+    message.msg_iov        = &iov;
+    message.msg_iovlen     = 1;
+    message.msg_control    = control.data();
+    message.msg_controllen = control.size();
+
+    if (recvmsg(socket, &message, MSG_CMSG_CLOEXEC) != 1) return false;
+
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    if (!header || header->cmsg_type != SCM_RIGHTS || header->cmsg_len != CMSG_LEN(count * sizeof(int))) return false;
+
+    memcpy(out_fds, CMSG_DATA(header), count * sizeof(int));
+    return true;
+}
+
+bool set_socket_timeout(int socket, int timeout_ms) {
+    timeval timeout{.tv_sec = timeout_ms / 1000, .tv_usec = timeout_ms % 1000 * 1000};
+    return setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0 &&
+           setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == 0;
+}
+
+static bool make_address(const char* path, sockaddr_un& address) {
+    address            = sockaddr_un{};
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) return false;
+
+    strcpy(address.sun_path, path);
+    return true;
+}
+
+int connect_unix_socket(const char* path) {
+    sockaddr_un address;
+    if (!make_address(path, address)) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int listen_unix_socket(const char* path) {
+    sockaddr_un address;
+    if (!make_address(path, address)) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    // a stale socket file from a previous server would make bind fail, one that still answers isn't ours to remove
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        int probe = connect_unix_socket(path);
+        if (probe >= 0) {
+            close(probe);
+            close(fd);
+            return -1;
+        }
+        unlink(path);
+    }
+
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(fd, 64) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool peer_is_same_user(int socket) {
+    ucred credentials;
+    socklen_t size = sizeof(credentials);
+    return getsockopt(socket, SOL_SOCKET, SO_PEERCRED, &credentials, &size) == 0 && credentials.uid == getuid();
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// blocking helpers for the length prefixed protocols spoken over unix sockets, all return false once the peer is gone
+
+bool write_all(int fd, const void* data, size_t size);
+bool read_all(int fd, void* data, size_t size);
+
+inline bool write_u32(int fd, uint32_t value) { return write_all(fd, &value, sizeof(value)); }
+inline bool write_str(int fd, std::string_view str) { return write_all(fd, str.data(), str.size()); }
+
+inline bool read_u32(int fd, uint32_t& value) { return read_all(fd, &value, sizeof(value)); }
+inline bool read_str(int fd, std::string& str, uint32_t len) {
+    str.resize(len);
+    return read_all(fd, str.data(), len);
+}
+
+// passes open file descriptors to the peer, the received ones are new descriptors for the same files
+bool send_fds(int socket, const int* fds, size_t count);
+bool recv_fds(int socket, int* out_fds, size_t count);
+
+// makes reads and writes on the socket fail instead of blocking for longer than timeout_ms
+bool set_socket_timeout(int socket, int timeout_ms);
+
+// returns -1 on failure
+int connect_unix_socket(const char* path);
+// also fails if another process still answers on path
+int listen_unix_socket(const char* path);
+
+// whether the process at the other end of a unix socket runs as our user
+bool peer_is_same_user(int socket);
@@ -0,0 +1,60 @@
+#include "thread_pool.hpp"
+
+ThreadPool::ThreadPool(size_t thread_count) {
+    if (thread_count == 0) thread_count = 1;
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        m_threads.emplace_back([this, i] { worker_loop(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(m_mutex);
+        m_stop = true;
+    }
+    m_work_cv.notify_all();
+
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::parallel_for(size_t count, const std::function<void(size_t, size_t)>& func) {
+    if (count == 0) return;
+
+    std::unique_lock lock(m_mutex);
+
+    m_func            = &func;
+    m_count           = count;
+    m_next            = 0;
+    m_running_workers = m_threads.size();
+    m_generation++;
+
+    m_work_cv.notify_all();
+    m_done_cv.wait(lock, [&] { return m_running_workers == 0; });
+
+    m_func = nullptr;
+}
+
+void ThreadPool::worker_loop(size_t worker_id) {
+    uint64_t seen_generation = 0;
+
+    while (true) {
+        std::unique_lock lock(m_mutex);
+        m_work_cv.wait(lock, [&] { return m_stop || m_generation != seen_generation; });
+        if (m_stop) return;
+
+        seen_generation = m_generation;
+        auto* func      = m_func;
+        size_t count    = m_count;
+        lock.unlock();
+
+        for (size_t index = m_next++; index < count; index = m_next++) {
+            (*func)(index, worker_id);
+        }
+
+        lock.lock();
+        if (--m_running_workers == 0) m_done_cv.notify_one();
+    }
+}
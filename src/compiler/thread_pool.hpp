@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    ThreadPool(size_t thread_count);
+    ~ThreadPool();
+
+    size_t thread_count() const { return m_threads.size(); }
+
+    // calls func(index, worker_id) for every index in [0, count) and blocks until all of them returned
+    void parallel_for(size_t count, const std::function<void(size_t, size_t)>& func);
+
+    ThreadPool(const ThreadPool&)            = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+private:
+    void worker_loop(size_t worker_id);
+
+private:
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_work_cv;
+    std::condition_variable m_done_cv;
+
+    const std::function<void(size_t, size_t)>* m_func = nullptr;
+    size_t m_count                                     = 0;
+    std::atomic<size_t> m_next                         = 0;
+    size_t m_running_workers                           = 0;
+    uint64_t m_generation                              = 0;
+    bool m_stop                                        = false;
+};
@@ -0,0 +1,185 @@
+#include "unused_functions.hpp"
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct FunctionDefinition {
+    std::string_view name;
+    size_t begin; // where its declaration starts, after the previous one
+    size_t end;   // one past the closing brace
+    bool has_directive = false; // a #line inside the body, removing it would shift the lines after it
+};
+
+static bool is_identifier_start(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static bool is_identifier_char(char c) {
+    return is_identifier_start(c) || (c >= '0' && c <= '9');
+}
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static void for_each_identifier(std::string_view text, auto&& func) {
+    size_t i = 0;
+    while (i < text.size()) {
+        if (is_identifier_start(text[i])) {
+            size_t start = i;
+            while (i < text.size() && is_identifier_char(text[i])) i++;
+            func(text.substr(start, i - start));
+        } else if (text[i] >= '0' && text[i] <= '9') {
+            // the suffix of a number like 1e5 or 0x1fu isn't an identifier
+            while (i < text.size() && is_identifier_char(text[i])) i++;
+        } else {
+            i++;
+        }
+    }
+}
+
+// the identifier right before pos, skipping blanks
+static std::string_view identifier_before(std::string_view text, size_t pos) {
+    while (pos > 0 && is_space(text[pos - 1])) pos--;
+
+    size_t end = pos;
+    while (pos > 0 && is_identifier_char(text[pos - 1])) pos--;
+    return text.substr(pos, end - pos);
+}
+
+// A definition is a parenthesis group followed by a brace at the top level, struct and interface block
+// bodies never directly follow a ')'. False if the braces or parentheses don't match up.
+static bool find_functions(std::string_view text, std::vector<FunctionDefinition>& out_functions) {
+    size_t declaration_start = 0;
+    size_t open_paren        = std::string_view::npos; // of the last top level group
+    size_t last_significant  = std::string_view::npos; // the last character that isn't a blank or in a comment
+    int paren_depth          = 0;
+    int brace_depth          = 0;
+    bool in_function         = false;
+    bool line_start          = true;
+
+    size_t i = 0;
+    while (i < text.size()) {
+        char c = text[i];
+
+        if (c == '\n') {
+            line_start = true;
+            i++;
+            continue;
+        }
+        if (c == ' ' || c == '\t' || c == '\r') {
+            i++;
+            continue;
+        }
+
+        // directives are left alone, between definitions they are never removed
+        if (c == '#' && line_start) {
+            size_t end = text.find('\n', i);
+            i          = end == std::string_view::npos ? text.size() : end;
+
+            if (in_function) out_functions.back().has_directive = true;
+            else if (brace_depth == 0) declaration_start = i;
+            continue;
+        }
+        line_start = false;
+
+        if (text.substr(i, 2) == "//") {
+            size_t end = text.find('\n', i);
+            i          = end == std::string_view::npos ? text.size() : end;
+            continue;
+        }
+        if (text.substr(i, 2) == "/*") {
+            size_t end = text.find("*/", i + 2);
+            i          = end == std::string_view::npos ? text.size() : end + 2;
+            continue;
+        }
+
+        if (brace_depth == 0) {
+            if (c == '(') {
+                if (paren_depth++ == 0) open_paren = i;
+            } else if (c == ')') {
+                if (--paren_depth < 0) return false;
+            } else if (c == ';' && paren_depth == 0) {
+                declaration_start = i + 1;
+            } else if (c == '{' && paren_depth == 0) {
+                bool after_paren = last_significant != std::string_view::npos && text[last_significant] == ')';
+
+                std::string_view name = after_paren ? identifier_before(text, open_paren) : std::string_view();
+                if (!name.empty()) {
+                    in_function = true;
+                    out_functions.push_back(FunctionDefinition{.name = name, .begin = declaration_start, .end = 0});
+                }
+                brace_depth = 1;
+            } else if (c == '}') {
+                return false;
+            }
+        } else if (c == '{') {
+            brace_depth++;
+        } else if (c == '}' && --brace_depth == 0 && in_function) {
+            in_function              = false;
+            out_functions.back().end = i + 1;
+            declaration_start        = i + 1;
+        }
+
+        last_significant = i;
+        i++;
+    }
+
+    return paren_depth == 0 && brace_depth == 0;
+}
+
+std::string strip_unused_functions(std::string_view preprocessed) {
+    std::vector<FunctionDefinition> functions;
+    if (!find_functions(preprocessed, functions) || functions.empty()) return std::string(preprocessed);
+
+    // overloads share a name, they are kept or dropped together
+    std::unordered_map<std::string_view, std::vector<const FunctionDefinition*>> by_name;
+    for (auto& function : functions) {
+        by_name[function.name].push_back(&function);
+    }
+
+    std::unordered_set<std::string_view> reachable;
+    std::vector<std::string_view> pending;
+    auto reach = [&](std::string_view name) {
+        if (by_name.contains(name) && reachable.insert(name).second) pending.push_back(name);
+    };
+
+    // everything outside of the definitions is kept, so is whatever it mentions
+    reach("main");
+    size_t pos = 0;
+    for (auto& function : functions) {
+        for_each_identifier(preprocessed.substr(pos, function.begin - pos), reach);
+        if (function.has_directive) reach(function.name);
+        pos = function.end;
+    }
+    for_each_identifier(preprocessed.substr(pos), reach);
+
+    while (!pending.empty()) {
+        std::string_view name = pending.back();
+        pending.pop_back();
+
+        for (auto* function : by_name[name]) {
+            for_each_identifier(preprocessed.substr(function->begin, function->end - function->begin), reach);
+        }
+    }
+
+    if (reachable.size() == by_name.size()) return std::string(preprocessed);
+
+    std::string stripped;
+    stripped.reserve(preprocessed.size());
+
+    pos = 0;
+    for (auto& function : functions) {
+        if (reachable.contains(function.name)) continue;
+
+        stripped.append(preprocessed.substr(pos, function.begin - pos));
+        for (size_t i = function.begin; i < function.end; ++i) {
+            if (preprocessed[i] == '\n') stripped += '\n';
+        }
+        pos = function.end;
+    }
+    stripped.append(preprocessed.substr(pos));
+
+    return stripped;
+}
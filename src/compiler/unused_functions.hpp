@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Drops the definitions of the functions main can't reach from preprocessed GLSL. glslang leaves them out of the
+// SPIR-V anyway, but only after parsing and checking them, which for large shared include libraries is most of
+// the work. A dropped definition is replaced by its newlines so that line numbers in errors stay right.
+// Anything that doesn't look like a sequence of declarations is returned unchanged.
+std::string strip_unused_functions(std::string_view preprocessed);
@@ -1,9 +1,11 @@
 #pragma once
 
+#include <string>
 #include <string_view>
 
 namespace vke {
 class ArenaAllocator;
 }
 
-std::string_view read_file(vke::ArenaAllocator* arena, const char* name);
\ No newline at end of file
+std::string_view read_file(vke::ArenaAllocator* arena, const char* name);
+std::string read_file(const char* name);
\ No newline at end of file
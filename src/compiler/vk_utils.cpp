@@ -1,5 +1,7 @@
 #include "vk_utlls.hpp"
 
+#include <stdexcept>
+
 VkPolygonMode parse_polygon_mode(const std::string& str) {
     if (str == "FILL") return VK_POLYGON_MODE_FILL;
     if (str == "LINE") return VK_POLYGON_MODE_LINE;
@@ -48,8 +50,8 @@ VkCompareOp parse_depth_op(const std::string& str) {
 
 
 VkShaderStageFlagBits infer_shader_stage(const std::string& filepath) {
-    if (filepath.ends_with(".vert")) return VK_SHADER_STAGE_VERTEX_BIT;
-    if (filepath.ends_with(".frag")) return VK_SHADER_STAGE_FRAGMENT_BIT;
+    if (filepath.ends_with(".vert") || filepath.ends_with(".vsh")) return VK_SHADER_STAGE_VERTEX_BIT;
+    if (filepath.ends_with(".frag") || filepath.ends_with(".fsh")) return VK_SHADER_STAGE_FRAGMENT_BIT;
     if (filepath.ends_with(".comp")) return VK_SHADER_STAGE_COMPUTE_BIT;
     if (filepath.ends_with(".tesc")) return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
     if (filepath.ends_with(".tese")) return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
@@ -57,6 +59,18 @@ VkShaderStageFlagBits infer_shader_stage(const std::string& filepath) {
     if (filepath.ends_with(".mesh")) return VK_SHADER_STAGE_MESH_BIT_EXT;
     if (filepath.ends_with(".task")) return VK_SHADER_STAGE_TASK_BIT_EXT;
 
-    // Default to vertex shader if the extension is not recognized
-    return VK_SHADER_STAGE_VERTEX_BIT;
+    throw std::runtime_error("Unknown shader file extension: " + filepath);
+}
+
+VkShaderStageFlagBits parse_shader_stage(const std::string& str) {
+    if (str == "VERTEX") return VK_SHADER_STAGE_VERTEX_BIT;
+    if (str == "FRAGMENT") return VK_SHADER_STAGE_FRAGMENT_BIT;
+    if (str == "COMPUTE") return VK_SHADER_STAGE_COMPUTE_BIT;
+    if (str == "TESS_CONTROL") return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+    if (str == "TESS_EVALUATION") return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+    if (str == "GEOMETRY") return VK_SHADER_STAGE_GEOMETRY_BIT;
+    if (str == "MESH") return VK_SHADER_STAGE_MESH_BIT_EXT;
+    if (str == "TASK") return VK_SHADER_STAGE_TASK_BIT_EXT;
+
+    throw std::runtime_error("Unknown shader stage: " + str);
 }
\ No newline at end of file
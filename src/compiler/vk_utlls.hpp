@@ -11,4 +11,8 @@ VkCullModeFlags parse_cull_mode(const std::string& str);
 
 VkCompareOp parse_depth_op(const std::string& str);
 
+// throws for a file extension that isn't a shader stage
 VkShaderStageFlagBits infer_shader_stage(const std::string& filepath);
+
+// a stage of a file that holds several, throws for an unknown name
+VkShaderStageFlagBits parse_shader_stage(const std::string& str);
@@ -0,0 +1,123 @@
+#include "watch.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "include_cache.hpp"
+
+namespace fs = std::filesystem;
+
+// editors save a file in several steps and often several files at once, wait for this long of quiet
+const int DEBOUNCE_MS = 100;
+
+// directories are watched instead of the files since most editors save by replacing the file
+const uint32_t WATCH_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE;
+
+// symlinks and ".." resolved, the dependencies name files the way they were reached through include directories
+static std::string resolved_path(const fs::path& path) {
+    std::error_code ec;
+    fs::path result = fs::weakly_canonical(fs::absolute(path, ec), ec);
+    return ec ? fs::absolute(path, ec).lexically_normal().native() : result.native();
+}
+
+class Watcher {
+public:
+    Watcher() { m_fd = inotify_init1(IN_CLOEXEC); }
+    ~Watcher() {
+        if (m_fd >= 0) close(m_fd);
+    }
+
+    bool is_valid() const { return m_fd >= 0; }
+
+    void watch(const std::vector<std::string>& files) {
+        m_files.clear();
+        for (auto& file : files) {
+            fs::path path = resolved_path(file);
+            m_files.insert(path.native());
+
+            std::string dir = path.parent_path().native();
+            if (m_watched_dirs.contains(dir)) continue;
+
+            int wd = inotify_add_watch(m_fd, dir.c_str(), WATCH_EVENTS);
+            if (wd < 0) {
+                fprintf(stderr, "failed to watch %s\n", dir.c_str());
+                continue;
+            }
+            m_watched_dirs.insert(dir);
+            m_dirs[wd] = dir;
+        }
+    }
+
+    // blocks until one of the files changed and no more events came in for DEBOUNCE_MS
+    std::vector<std::string> wait_for_changes() {
+        std::unordered_set<std::string> changed;
+
+        while (changed.empty()) {
+            read_events(-1, changed);
+        }
+        while (read_events(DEBOUNCE_MS, changed)) {}
+
+        return std::vector<std::string>(changed.begin(), changed.end());
+    }
+
+private:
+    // false if nothing happened within timeout_ms
+    bool read_events(int timeout_ms, std::unordered_set<std::string>& changed) {
+        pollfd pfd{.fd = m_fd, .events = POLLIN, .revents = 0};
+        if (poll(&pfd, 1, timeout_ms) <= 0) return false;
+
+        alignas(inotify_event) char buffer[16384];
+        ssize_t size = read(m_fd, buffer, sizeof(buffer));
+
+        for (ssize_t offset = 0; offset < size;) {
+            auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+
+            auto dir = m_dirs.find(event->wd);
+            if (dir == m_dirs.end() || event->len == 0) continue;
+
+            // the directory is canonical, the name may still be a symlink
+            std::string path = resolved_path(fs::path(dir->second) / event->name);
+            if (m_files.contains(path)) changed.insert(path);
+        }
+        return true;
+    }
+
+private:
+    int m_fd;
+    std::unordered_set<std::string> m_files;
+    std::unordered_set<std::string> m_watched_dirs;
+    std::unordered_map<int, std::string> m_dirs; // by watch descriptor
+};
+
+int run_watch(const std::function<std::vector<std::string>()>& build) {
+    Watcher watcher;
+    if (!watcher.is_valid()) {
+        fprintf(stderr, "failed to initialize inotify\n");
+        return 1;
+    }
+
+    watcher.watch(build());
+
+    while (true) {
+        printf("watching for changes\n");
+        fflush(stdout);
+
+        std::vector<std::string> changed = watcher.wait_for_changes();
+        IncludeCache::process_cache().invalidate(changed);
+
+        printf("%zu files changed, rebuilding\n", changed.size());
+        auto start = std::chrono::steady_clock::now();
+
+        watcher.watch(build());
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        printf("rebuilt in %lld ms\n", (long long)elapsed.count());
+    }
+}
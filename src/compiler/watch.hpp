@@ -0,0 +1,10 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Runs build, then runs it again whenever one of the files it returned changes, until the process is killed.
+// build is expected to be incremental and to replace its output atomically, the changed files are
+// invalidated in the include cache before it runs.
+int run_watch(const std::function<std::vector<std::string>()>& build);
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+
+// A tiny harness shared by the test programs: cases are registered with TEST, checked with CHECK and all run by
+// test::run_all. A failed CHECK reports itself and lets the case go on so one run shows every problem.
+
+namespace test {
+
+namespace fs = std::filesystem;
+
+struct Case {
+    const char* name;
+    void (*func)();
+};
+
+inline std::vector<Case>& cases() {
+    static std::vector<Case> cases;
+    return cases;
+}
+
+inline int& failures() {
+    static int failures = 0;
+    return failures;
+}
+
+struct Registration {
+    Registration(const char* name, void (*func)()) { cases().push_back(Case{.name = name, .func = func}); }
+};
+
+// an empty directory for one case under the working directory, left behind for inspection
+inline fs::path make_dir(std::string_view name) {
+    fs::path dir = fs::current_path() / "test_data" / (std::string(name) + "-" + std::to_string(getpid()));
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    return dir;
+}
+
+// replaced rather than overwritten, so every change gets a new inode like an editor save
+inline void write_file(const fs::path& path, std::string_view content) {
+    fs::create_directories(path.parent_path());
+
+    fs::path tmp_path = path;
+    tmp_path += ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+        file.write(content.data(), content.size());
+    }
+    fs::rename(tmp_path, path);
+}
+
+inline std::string read_file(const fs::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+inline int run_all() {
+    for (auto& test_case : cases()) {
+        int failures_before = failures();
+        test_case.func();
+
+        printf("%s %s\n", failures() == failures_before ? "passed" : "FAILED", test_case.name);
+        fflush(stdout);
+    }
+
+    return failures() == 0 ? 0 : 1;
+}
+
+} // namespace test
+
+#define TEST(name)                                              \
+    static void name();                                         \
+    static test::Registration name##_registration(#name, name); \
+    static void name()
+
+#define CHECK(condition)                                                                  \
+    do {                                                                                  \
+        if (!(condition)) {                                                               \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            test::failures()++;                                                           \
+        }                                                                                 \
+    } while (0)
@@ -0,0 +1,696 @@
+#include <atomic>
+#include <csignal>
+#include <fcntl.h>
+#include <map>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <file_header.hpp>
+#include <shader_db.hpp>
+
+#include "compile_history.hpp"
+#include "compile_server.hpp"
+#include "depfile.hpp"
+#include "jobserver.hpp"
+#include "db_linker.hpp"
+#include "include_cache.hpp"
+#include "pipeline_db_builder.hpp"
+#include "process_pool.hpp"
+#include "socket_io.hpp"
+#include "watch.hpp"
+#include "test.hpp"
+
+// builds of small generated material files through PipelineDBConstructor, like the command line does
+
+static const char* VERTEX_SHADER = R"(#version 450
+
+#include "common.glsl"
+
+void main() {
+    gl_Position = vec4(SCALE);
+}
+)";
+
+static const char* FRAGMENT_SHADER = R"(#version 450
+
+layout(location = 0) out vec4 color_out;
+
+void main() {
+    color_out = vec4(1.0, 0.0, 0.0, 1.0);
+}
+)";
+
+static const char* COMMON_INCLUDE = R"(#pragma once
+
+#ifndef SCALE_VALUE
+#define SCALE_VALUE 1.0
+#endif
+
+const float SCALE = SCALE_VALUE;
+)";
+
+static std::string pipeline_json(const std::string& name, const std::string& scale) {
+    return R"({"name": ")" + name + R"(", "renderpass": "MainRenderPass", "depth_test": true,
+               "compiler_definitions": {"SCALE_VALUE": ")" + scale + R"("},
+               "shader_files": ["shaders/a.vert", "shaders/a.frag"]})";
+}
+
+// a material with count pipelines that only differ in a definition
+static fs::path write_material(const fs::path& dir, size_t count) {
+    test::write_file(dir / "shaders/a.vert", VERTEX_SHADER);
+    test::write_file(dir / "shaders/a.frag", FRAGMENT_SHADER);
+    test::write_file(dir / "shaders/common.glsl", COMMON_INCLUDE);
+
+    std::string pipelines;
+    for (size_t i = 0; i < count; ++i) {
+        if (i > 0) pipelines += ",\n";
+        pipelines += pipeline_json("Pipeline" + std::to_string(i), std::to_string(i + 1) + ".0");
+    }
+
+    fs::path material = dir / "material.json";
+    test::write_file(material, "{\"pipelines\": [\n" + pipelines + "\n]}\n");
+    return material;
+}
+
+static bool build(PipelineDBConstructor& builder, const fs::path& material, const fs::path& output) {
+    // the files of earlier cases may have been replaced
+    IncludeCache::process_cache().revalidate();
+
+    std::string material_file = material.native();
+    const char* material_files[] = {material_file.c_str()};
+    return builder.build(material_files, output.c_str());
+}
+
+static bool build(const fs::path& material, const fs::path& output, size_t thread_count = 4) {
+    PipelineDBConstructor builder(thread_count);
+    return build(builder, material, output);
+}
+
+// the pipelines of a database in the order they were written, pointing into data
+static std::vector<const CompiledPipeline*> pipelines(const std::string& data) {
+    if (data.size() < sizeof(ShaderDBHeader)) return {};
+
+    auto* header = reinterpret_cast<const ShaderDBHeader*>(data.data());
+
+    std::vector<const CompiledPipeline*> pipelines;
+    size_t offset = sizeof(ShaderDBHeader);
+    for (uint32_t i = 0; i < header->shader_count && offset + sizeof(CompiledPipeline) <= data.size(); ++i) {
+        auto* pipeline = reinterpret_cast<const CompiledPipeline*>(data.data() + offset);
+        pipelines.push_back(pipeline);
+        offset += pipeline->total_size;
+    }
+    return pipelines;
+}
+
+static std::vector<std::string> pipeline_names(const fs::path& output) {
+    std::string data = test::read_file(output);
+
+    std::vector<std::string> names;
+    for (auto* pipeline : pipelines(data)) {
+        names.emplace_back(pipeline->shader_name, strnlen(pipeline->shader_name, sizeof(pipeline->shader_name)));
+    }
+    return names;
+}
+
+static std::vector<uint32_t> stage_spv(const CompiledPipeline* pipeline, int stage_index) {
+    std::span<const uint32_t> spv = pipeline->get_stage_spv(stage_index);
+    return std::vector<uint32_t>(spv.begin(), spv.end());
+}
+
+TEST(parallel_build_matches_serial_build) {
+    fs::path dir      = test::make_dir("parallel_build");
+    fs::path material = write_material(dir, 24);
+
+    CHECK(build(material, dir / "serial.bin", 1));
+    CHECK(build(material, dir / "parallel.bin", 8));
+
+    std::string serial = test::read_file(dir / "serial.bin");
+    CHECK(!serial.empty());
+    CHECK(serial == test::read_file(dir / "parallel.bin"));
+
+    std::vector<std::string> names = pipeline_names(dir / "serial.bin");
+    CHECK(names.size() == 24);
+    CHECK(!names.empty() && names.front() == "Pipeline0" && names.back() == "Pipeline23");
+}
+
+TEST(worker_processes_match_serial_build) {
+    fs::path dir      = test::make_dir("worker_processes");
+    fs::path material = write_material(dir, 24);
+
+    CHECK(build(material, dir / "serial.bin", 1));
+
+    PipelineDBConstructor builder(4, true);
+    CHECK(build(builder, material, dir / "processes.bin"));
+
+    std::string serial = test::read_file(dir / "serial.bin");
+    CHECK(!serial.empty());
+    CHECK(serial == test::read_file(dir / "processes.bin"));
+}
+
+TEST(a_dead_worker_process_is_replaced) {
+    ProcessWorkerPool pool(1);
+    std::string path = "dead_worker.frag";
+
+    std::vector<uint32_t> spv = pool.compile_glsl(0, path, VK_SHADER_STAGE_FRAGMENT_BIT, FRAGMENT_SHADER, {});
+    CHECK(!spv.empty());
+
+    // like a crash or the OOM killer in the middle of a build
+    pid_t first_worker = pool.worker_pid(0);
+    kill(first_worker, SIGKILL);
+
+    bool failed = false;
+    try {
+        pool.compile_glsl(0, path, VK_SHADER_STAGE_FRAGMENT_BIT, FRAGMENT_SHADER, {});
+    } catch (const std::exception&) {
+        failed = true;
+    }
+    CHECK(failed);
+
+    // only the job it died on is lost
+    CHECK(pool.worker_pid(0) != first_worker);
+    CHECK(pool.compile_glsl(0, path, VK_SHADER_STAGE_FRAGMENT_BIT, FRAGMENT_SHADER, {}) == spv);
+}
+
+TEST(broken_pipelines_fail_the_build_but_not_the_others) {
+    fs::path dir      = test::make_dir("broken_pipelines");
+    fs::path material = write_material(dir, 1);
+
+    test::write_file(dir / "shaders/broken.frag", "#version 450\n#include \"missing.glsl\"\nvoid main() {}\n");
+    test::write_file(material, R"({"pipelines": [
+        {"name": "Good", "shader_files": ["shaders/a.vert", "shaders/a.frag"]},
+        {"name": "Broken", "shader_files": ["shaders/a.vert", "shaders/broken.frag"]},
+        {"name": "TooManyStages", "shader_files": ["shaders/a.vert", "shaders/a.frag", "shaders/a.vert", "shaders/a.frag", "shaders/a.vert", "shaders/a.frag"]},
+        {"name": "Last", "shader_files": ["shaders/a.vert", "shaders/a.frag"]}
+    ]})");
+
+    CHECK(!build(material, dir / "out.bin"));
+    CHECK(pipeline_names(dir / "out.bin") == std::vector<std::string>({"Good", "Last"}));
+}
+
+// with debug info the SPIR-V has to carry the source as written, like a plain compile of the file gives
+TEST(debug_info_keeps_the_source_as_written) {
+    fs::path dir      = test::make_dir("debug_info");
+    fs::path material = write_material(dir, 2);
+
+    PipelineDBConstructor builder(2);
+    CHECK(build(builder, material, dir / "out.bin"));
+    CHECK(builder.deduplicated_stages() == 0);
+
+    std::string data = test::read_file(dir / "out.bin");
+    auto written     = pipelines(data);
+    CHECK(written.size() == 2);
+
+    ShaderCompilerContext context;
+    for (size_t i = 0; i < written.size(); ++i) {
+        std::vector<std::pair<std::string, std::string>> definitions = {{"SCALE_VALUE", std::to_string(i + 1) + ".0"}};
+
+        CHECK(stage_spv(written[i], 0) == context.compile_glsl((dir / "shaders/a.vert").native(), VK_SHADER_STAGE_VERTEX_BIT, VERTEX_SHADER, definitions));
+        CHECK(stage_spv(written[i], 1) == context.compile_glsl((dir / "shaders/a.frag").native(), VK_SHADER_STAGE_FRAGMENT_BIT, FRAGMENT_SHADER, definitions));
+    }
+}
+
+// without it stages whose definitions don't change their preprocessed text are compiled once
+TEST(without_debug_info_identical_preprocessed_stages_compile_once) {
+    fs::path dir      = test::make_dir("no_debug_info");
+    fs::path material = write_material(dir, 0);
+
+    test::write_file(dir / "shaders/flip.vert", "#version 450\nvoid main() {\n    gl_Position = vec4(1.0);\n#ifndef KEEP_Y\n    gl_Position.y = -gl_Position.y;\n#endif\n}\n");
+    test::write_file(material, R"({"pipelines": [
+        {"name": "Flipped", "shader_files": ["shaders/flip.vert", "shaders/a.frag"]},
+        {"name": "Upright", "compiler_definitions": {"KEEP_Y": "1"}, "shader_files": ["shaders/flip.vert", "shaders/a.frag"]}
+    ]})");
+
+    PipelineDBConstructor builder(2, false, CompilerSettings{.debug_info = false});
+    CHECK(build(builder, material, dir / "out.bin"));
+    CHECK(builder.deduplicated_stages() == 1);
+
+    std::string data = test::read_file(dir / "out.bin");
+    auto written     = pipelines(data);
+    CHECK(written.size() == 2);
+    CHECK(written.size() == 2 && stage_spv(written[0], 0) != stage_spv(written[1], 0));
+    CHECK(written.size() == 2 && stage_spv(written[0], 1) == stage_spv(written[1], 1));
+}
+
+TEST(only_stages_spelled_the_same_share_a_compile_with_debug_info) {
+    fs::path dir      = test::make_dir("spelled_paths");
+    fs::path material = write_material(dir, 0);
+
+    test::write_file(material, R"({"pipelines": [
+        {"name": "First", "shader_files": ["shaders/a.frag"]},
+        {"name": "Second", "shader_files": ["shaders/../shaders/a.frag"]},
+        {"name": "Third", "shader_files": ["shaders/a.frag"]}
+    ]})");
+
+    // the debug info names the file, the second spelling needs a compile of its own
+    PipelineDBConstructor debug_info_builder(2);
+    CHECK(build(debug_info_builder, material, dir / "debug_info.bin"));
+    CHECK(debug_info_builder.deduplicated_stages() == 1);
+
+    PipelineDBConstructor builder(2, false, CompilerSettings{.debug_info = false});
+    CHECK(build(builder, material, dir / "out.bin"));
+    CHECK(builder.deduplicated_stages() == 2);
+}
+
+TEST(unchanged_pipelines_are_copied_from_the_previous_output) {
+    fs::path dir      = test::make_dir("incremental");
+    fs::path material = write_material(dir, 4);
+    fs::path output   = dir / "out.bin";
+
+    PipelineDBConstructor builder(4);
+    CHECK(build(builder, material, output));
+    CHECK(builder.reused_pipelines() == 0);
+    std::string first = test::read_file(output);
+
+    CHECK(build(builder, material, output));
+    CHECK(builder.reused_pipelines() == 4);
+    CHECK(test::read_file(output) == first);
+
+    // every pipeline includes it
+    test::write_file(dir / "shaders/common.glsl", std::string(COMMON_INCLUDE) + "const float OFFSET = 0.5;\n");
+    CHECK(build(builder, material, output));
+    CHECK(builder.reused_pipelines() == 0);
+}
+
+TEST(reordered_stages_of_an_uber_file_are_rebuilt) {
+    fs::path dir      = test::make_dir("uber_order");
+    fs::path material = dir / "material.json";
+    fs::path output   = dir / "out.bin";
+    test::write_file(dir / "shaders/uber.glsl", "#version 450\n\nvoid main() {\n}\n");
+
+    auto write_uber_material = [&](const std::string& stages) {
+        test::write_file(material, R"({"pipelines": [{"name": "Uber", "renderpass": "MainRenderPass", "stages": [)" + stages +
+                                       R"(], "shader_files": ["shaders/uber.glsl"]}]})");
+    };
+
+    PipelineDBConstructor builder(4);
+    write_uber_material(R"("VERTEX", "FRAGMENT")");
+    CHECK(build(builder, material, output));
+    std::string first = test::read_file(output);
+
+    // the same path and definitions, only the stage of each record changed
+    write_uber_material(R"("FRAGMENT", "VERTEX")");
+    CHECK(build(builder, material, output));
+    CHECK(builder.reused_pipelines() == 0);
+
+    std::string second = test::read_file(output);
+    CHECK(pipelines(first).size() == 1 && pipelines(second).size() == 1);
+    if (pipelines(first).size() == 1 && pipelines(second).size() == 1) {
+        CHECK(stage_spv(pipelines(second)[0], 0) == stage_spv(pipelines(first)[0], 1));
+        CHECK(stage_spv(pipelines(second)[0], 1) == stage_spv(pipelines(first)[0], 0));
+    }
+}
+
+TEST(databases_of_another_version_are_not_reused) {
+    fs::path dir      = test::make_dir("other_version");
+    fs::path material = write_material(dir, 2);
+    fs::path output   = dir / "out.bin";
+
+    PipelineDBConstructor builder(2);
+    CHECK(build(builder, material, output));
+    std::string data = test::read_file(output);
+
+    auto* header = reinterpret_cast<ShaderDBHeader*>(data.data());
+    CHECK(header->magic == SHADER_DB_MAGIC && header->version == SHADER_DB_VERSION);
+
+    header->version++;
+    test::write_file(output, data);
+
+    CHECK(build(builder, material, output));
+    CHECK(builder.reused_pipelines() == 0);
+    CHECK(pipeline_names(output) == std::vector<std::string>({"Pipeline0", "Pipeline1"}));
+}
+
+TEST(shader_db_only_loads_databases_of_its_version) {
+    fs::path dir      = test::make_dir("shader_db");
+    fs::path material = write_material(dir, 2);
+
+    CHECK(build(material, dir / "out.bin"));
+    std::string data = test::read_file(dir / "out.bin");
+    auto* header     = reinterpret_cast<ShaderDBHeader*>(data.data());
+
+    ShaderDB db;
+    CHECK(db.load_db(header));
+    CHECK(db.get_pipeline_db("Pipeline1") != nullptr);
+
+    header->magic = 0;
+    ShaderDB foreign;
+    CHECK(!foreign.load_db(header));
+
+    header->magic = SHADER_DB_MAGIC;
+    header->version++;
+    ShaderDB other_version;
+    CHECK(!other_version.load_db(header));
+}
+
+// a material with one pipeline of the shaders of write_material and the given "variants" block
+static fs::path write_variant_material(const fs::path& dir, const std::string& variants) {
+    write_material(dir, 0);
+
+    fs::path material = dir / "variants.json";
+    test::write_file(material, R"({"pipelines": [{"name": "Lit", "renderpass": "MainRenderPass", "variants": )" + variants +
+                                   R"(, "shader_files": ["shaders/a.vert", "shaders/a.frag"]}]})");
+    return material;
+}
+
+TEST(variants_are_found_by_their_mask) {
+    fs::path dir = test::make_dir("variants");
+    // SHADOWS takes bit 0, QUALITY bits 1 and 2 and the single FIXED value none
+    fs::path material = write_variant_material(dir, R"({"SHADOWS": [0, 1], "QUALITY": ["LOW", "MID", "HIGH"], "FIXED": [1]})");
+
+    CHECK(build(material, dir / "out.bin"));
+    CHECK(pipeline_names(dir / "out.bin").size() == 6);
+
+    std::string data = test::read_file(dir / "out.bin");
+    ShaderDB db;
+    CHECK(db.load_db(reinterpret_cast<ShaderDBHeader*>(data.data())));
+
+    CompiledPipeline* high_shadows = db.get_pipeline_variant("Lit", 1 | 2 << 1);
+    CompiledPipeline* low          = db.get_pipeline_variant("Lit", 0);
+    CHECK(high_shadows != nullptr && std::string_view(high_shadows->shader_name) == "Lit#5");
+    CHECK(low != nullptr && std::string_view(low->shader_name) == "Lit#0");
+    if (high_shadows && low) CHECK(stage_spv(high_shadows, 0) != stage_spv(low, 0));
+
+    // QUALITY has no fourth value, and the name has to match as well
+    CHECK(db.get_pipeline_variant("Lit", 1 | 3 << 1) == nullptr);
+    CHECK(db.get_pipeline_variant("Li", 0) == nullptr);
+}
+
+TEST(too_many_variant_combinations_fail_the_pipeline) {
+    fs::path dir = test::make_dir("too_many_variants");
+
+    // 2^13 combinations
+    std::string variants;
+    for (int i = 0; i < 13; ++i) {
+        variants += std::string(i > 0 ? ", " : "") + "\"MACRO_" + std::to_string(i) + "\": [0, 1]";
+    }
+    fs::path material = write_variant_material(dir, "{" + variants + "}");
+
+    CHECK(!build(material, dir / "out.bin"));
+    CHECK(pipeline_names(dir / "out.bin").empty());
+}
+
+// the records of a database by name
+static std::map<std::string, std::string> pipeline_records(const fs::path& output) {
+    std::string data = test::read_file(output);
+
+    std::map<std::string, std::string> records;
+    for (auto* pipeline : pipelines(data)) {
+        std::string name(pipeline->shader_name, strnlen(pipeline->shader_name, sizeof(pipeline->shader_name)));
+        records[name] = std::string(reinterpret_cast<const char*>(pipeline), pipeline->total_size);
+    }
+    return records;
+}
+
+TEST(linked_shards_match_a_full_build) {
+    fs::path dir      = test::make_dir("shards");
+    fs::path material = write_material(dir, 12);
+
+    CHECK(build(material, dir / "full.bin"));
+
+    std::vector<std::string> shard_files;
+    for (size_t i = 0; i < 3; ++i) {
+        PipelineDBConstructor builder(2);
+        builder.set_shard(i, 3);
+
+        shard_files.push_back((dir / ("shard" + std::to_string(i) + ".bin")).native());
+        CHECK(build(builder, material, shard_files.back()));
+    }
+
+    std::vector<const char*> inputs;
+    for (auto& file : shard_files) inputs.push_back(file.c_str());
+    CHECK(run_linker((dir / "linked.bin").c_str(), inputs) == 0);
+
+    auto full = pipeline_records(dir / "full.bin");
+    CHECK(full.size() == 12);
+    CHECK(pipeline_records(dir / "linked.bin") == full);
+
+    // a shard can't be linked with itself, it defines the same names twice
+    const char* twice[] = {inputs[0], inputs[0]};
+    CHECK(run_linker((dir / "twice.bin").c_str(), twice) != 0);
+}
+
+TEST(linker_rejects_sizes_beyond_the_end_of_the_file) {
+    fs::path dir      = test::make_dir("linker_sizes");
+    fs::path material = write_material(dir, 2);
+
+    CHECK(build(material, dir / "out.bin"));
+    std::string data = test::read_file(dir / "out.bin");
+
+    std::string huge_record = data;
+    reinterpret_cast<CompiledPipeline*>(huge_record.data() + sizeof(ShaderDBHeader))->total_size = 0xfffffff0;
+    test::write_file(dir / "huge_record.bin", huge_record);
+
+    std::string huge_table = data;
+    reinterpret_cast<ShaderDBHeader*>(huge_table.data())->variant_count = 0xfffffff;
+    test::write_file(dir / "huge_table.bin", huge_table);
+
+    test::write_file(dir / "truncated.bin", data.substr(0, data.size() - 16));
+
+    for (const char* name : {"huge_record.bin", "huge_table.bin", "truncated.bin"}) {
+        std::string input    = (dir / name).native();
+        const char* inputs[] = {input.c_str()};
+        CHECK(run_linker((dir / "linked.bin").c_str(), inputs) != 0);
+    }
+}
+
+TEST(depfile_escapes_what_make_would_split_or_expand) {
+    fs::path dir = test::make_dir("depfile");
+
+    std::vector<std::string> dependencies = {"/shaders/my shader.glsl", "/shaders/a#b.glsl", "/shaders/cost$.glsl", "/shaders/back\\slash.glsl", "relative.glsl"};
+    CHECK(write_depfile("out.bin.d", "out.bin", dependencies, dir.native()));
+
+    // relative paths are taken relative to the working directory that was passed
+    std::string prefix   = dir.native() + "/";
+    std::string expected = prefix + "out.bin: \\\n"
+                           "  /shaders/my\\ shader.glsl \\\n"
+                           "  /shaders/a\\#b.glsl \\\n"
+                           "  /shaders/cost$$.glsl \\\n"
+                           "  /shaders/back\\\\slash.glsl \\\n"
+                           "  " + prefix + "relative.glsl\n";
+    CHECK(test::read_file(dir / "out.bin.d") == expected);
+}
+
+TEST(makeflags_name_the_last_jobserver) {
+    CHECK(jobserver_auth(" -j4 --jobserver-auth=3,4") == "3,4");
+    CHECK(jobserver_auth("--jobserver-fds=3,4 -j --jobserver-auth=fifo:/tmp/make") == "fifo:/tmp/make");
+    CHECK(jobserver_auth("--jobserver-auth=3,4 --jobserver-fds=5,6") == "5,6");
+    CHECK(jobserver_auth("-j4").empty());
+    CHECK(jobserver_auth("").empty());
+}
+
+TEST(jobserver_clients_come_from_makeflags) {
+    fs::path dir                = test::make_dir("jobserver");
+    const char* old_makeflags   = getenv("MAKEFLAGS");
+    std::string saved_makeflags = old_makeflags ? old_makeflags : "";
+
+    // two tokens besides the implicit one
+    int pipe_fds[2];
+    CHECK(pipe(pipe_fds) == 0);
+    CHECK(write(pipe_fds[1], "++", 2) == 2);
+
+    setenv("MAKEFLAGS", (" -j3 --jobserver-auth=" + std::to_string(pipe_fds[0]) + "," + std::to_string(pipe_fds[1])).c_str(), 1);
+    {
+        auto client = JobServerClient::from_environment();
+        CHECK(client != nullptr);
+        if (client) {
+            int tokens[3] = {client->acquire(), client->acquire(), client->acquire()};
+            for (int token : tokens) client->release(token);
+        }
+    }
+    // every token went back to make
+    char tokens[4];
+    fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK);
+    CHECK(read(pipe_fds[0], tokens, sizeof(tokens)) == 2);
+
+    std::string fifo = (dir / "fifo").native();
+    CHECK(mkfifo(fifo.c_str(), 0600) == 0);
+    int fifo_fd = open(fifo.c_str(), O_RDWR);
+    CHECK(write(fifo_fd, "+", 1) == 1);
+
+    setenv("MAKEFLAGS", ("-j2 --jobserver-auth=fifo:" + fifo).c_str(), 1);
+    {
+        auto client = JobServerClient::from_environment();
+        CHECK(client != nullptr);
+        if (client) {
+            int implicit = client->acquire();
+            int token    = client->acquire();
+            client->release(token);
+            client->release(implicit);
+        }
+    }
+
+    // malformed, closed descriptors, no jobserver at all
+    for (const char* makeflags : {"--jobserver-auth=abc", "--jobserver-auth=1000,1001", "--jobserver-auth=fifo:/nonexistent/fifo", "-j8"}) {
+        setenv("MAKEFLAGS", makeflags, 1);
+        CHECK(JobServerClient::from_environment() == nullptr);
+    }
+    unsetenv("MAKEFLAGS");
+    CHECK(JobServerClient::from_environment() == nullptr);
+
+    if (old_makeflags) setenv("MAKEFLAGS", saved_makeflags.c_str(), 1);
+    close(fifo_fd);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+}
+
+TEST(compile_history_starts_over_on_every_load) {
+    fs::path dir = test::make_dir("history");
+
+    CompileHistory history;
+    history.record("a.vert:1", 100);
+    CHECK(history.save((dir / "first.timings").c_str()));
+
+    history.load((dir / "first.timings").c_str());
+    CHECK(history.predict("a.vert:1", 7) == 100);
+    history.record("b.vert:1", 200);
+
+    // nothing of the first output leaks into the second
+    history.load((dir / "missing.timings").c_str());
+    CHECK(history.predict("a.vert:1", 7) == 7);
+    CHECK(history.save((dir / "second.timings").c_str()));
+    CHECK(test::read_file(dir / "second.timings").empty());
+}
+
+TEST(compile_history_survives_a_build_that_reuses_everything) {
+    fs::path dir             = test::make_dir("history_reuse");
+    fs::path material        = write_material(dir, 3);
+    fs::path output          = dir / "out.bin";
+    std::string history_file = (dir / "out.bin.timings").native();
+
+    PipelineDBConstructor builder(4);
+    builder.load_compile_history(history_file.c_str());
+    CHECK(build(builder, material, output));
+    CHECK(builder.save_compile_history(history_file.c_str()));
+    std::string first = test::read_file(history_file);
+    CHECK(!first.empty());
+
+    // nothing is compiled, every stage keeps its time
+    builder.load_compile_history(history_file.c_str());
+    CHECK(build(builder, material, output));
+    CHECK(builder.reused_pipelines() == 3);
+    CHECK(builder.save_compile_history(history_file.c_str()));
+    CHECK(test::read_file(history_file).size() == first.size());
+
+    CompileHistory history;
+    history.load(history_file.c_str());
+    std::string key = CompileHistory::make_key((dir / "shaders/a.vert").native(), VK_SHADER_STAGE_VERTEX_BIT, {{"SCALE_VALUE", "1.0"}});
+    CHECK(history.predict(key, UINT64_MAX) != UINT64_MAX);
+}
+
+// waits up to two seconds for builds to reach count
+static bool wait_for_builds(const std::atomic<int>& builds, int count) {
+    for (int i = 0; i < 200 && builds < count; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return builds >= count;
+}
+
+TEST(watch_sees_changes_behind_symlinks_and_dot_dots) {
+    fs::path dir = test::make_dir("watch_symlinks");
+    test::write_file(dir / "real/lib.glsl", "");
+    test::write_file(dir / "real/nested/other.glsl", "");
+    fs::create_directories(dir / "include");
+    fs::create_symlink("../real/lib.glsl", dir / "include/lib.glsl");
+    fs::create_directory_symlink(dir / "real/nested", dir / "nested_link");
+
+    // how an include directory may have led to them, lexically the second one would be dir/other.glsl
+    std::vector<std::string> dependencies = {(dir / "include/lib.glsl").native(), (dir / "nested_link/../other.glsl").native()};
+    test::write_file(dir / "real/other.glsl", "");
+
+    // the watcher never returns and goes away with the test process
+    auto builds = std::make_shared<std::atomic<int>>(0);
+    std::thread([builds, dependencies] {
+        run_watch([builds, dependencies] {
+            (*builds)++;
+            return dependencies;
+        });
+    }).detach();
+
+    CHECK(wait_for_builds(*builds, 1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    test::write_file(dir / "real/lib.glsl", "// edited\n");
+    CHECK(wait_for_builds(*builds, 2));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    test::write_file(dir / "real/other.glsl", "// edited\n");
+    CHECK(wait_for_builds(*builds, 3));
+}
+
+TEST(compile_server_builds_in_the_directory_of_the_client) {
+    fs::path dir = test::make_dir("compile_server");
+    write_material(dir, 2);
+
+    // unix socket paths are short, so it doesn't go into the test directory
+    std::string socket = (fs::temp_directory_path() / ("shader_compiler_test-server-" + std::to_string(getpid()) + ".sock")).native();
+
+    // the server never returns and goes away with the test process
+    std::thread([socket] {
+        run_compile_server(socket.c_str(), "test options", [](const BuildRequest& request, ServedClient& client) {
+            IncludeCache::process_cache().set_working_directory(request.working_directory);
+
+            PipelineDBConstructor builder(2);
+            builder.set_error_output(client.err);
+            bool success = build(builder, request.material_files[0], request.output_file);
+
+            IncludeCache::process_cache().set_working_directory("");
+            return success;
+        });
+    }).detach();
+
+    fs::path working_directory = fs::current_path();
+    BuildRequest request{
+        .working_directory  = dir.native(),
+        .material_files     = {"material.json"},
+        .output_file        = "out.bin",
+        .include_dirs       = {},
+        .incremental        = true,
+        .shard_index        = 0,
+        .shard_count        = 1,
+        .write_dependencies = false,
+        .depfile            = "",
+        .print_cache_stats  = false,
+        .options            = "test options",
+    };
+
+    int exit_code = -1;
+    bool served   = false;
+    for (int i = 0; i < 100 && !served; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        served = run_on_server(socket.c_str(), request, exit_code);
+    }
+    CHECK(served);
+    CHECK(exit_code == 0);
+    CHECK(pipeline_names(dir / "out.bin") == std::vector<std::string>({"Pipeline0", "Pipeline1"}));
+    CHECK(fs::current_path() == working_directory);
+
+    // a server started with other options would build something else
+    request.options = "other options";
+    exit_code       = -1;
+    CHECK(!run_on_server(socket.c_str(), request, exit_code));
+    CHECK(exit_code == -1);
+
+    // a client that connects and never sends its request only holds up the next one until it times out
+    int stalled = connect_unix_socket(socket.c_str());
+    CHECK(stalled >= 0);
+    request.options = "test options";
+    exit_code       = -1;
+    CHECK(run_on_server(socket.c_str(), request, exit_code));
+    CHECK(exit_code == 0);
+    close(stalled);
+
+    // the socket of a running server is left alone
+    CHECK(listen_unix_socket(socket.c_str()) < 0);
+    int probe = connect_unix_socket(socket.c_str());
+    CHECK(probe >= 0);
+    close(probe);
+
+    unlink(socket.c_str());
+}
+
+int main() {
+    return test::run_all();
+}
@@ -0,0 +1,292 @@
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "cache_backend.hpp"
+#include "hash.hpp"
+#include "include_cache.hpp"
+#include "remote_cache.hpp"
+#include "shm_cache.hpp"
+#include "socket_io.hpp"
+#include "test.hpp"
+
+// the caches compile results go through, each checked on its own
+
+namespace fs = std::filesystem;
+
+// starts with the SPIR-V magic, anything else is taken for a broken entry
+static std::vector<uint32_t> test_spv(uint32_t id, size_t size_words = 8) {
+    std::vector<uint32_t> spv(size_words, id);
+    spv[0] = 0x07230203;
+    return spv;
+}
+
+static size_t count_cache_files(const fs::path& dir) {
+    size_t count = 0;
+    for (auto& file : fs::recursive_directory_iterator(dir)) {
+        if (file.path().extension() == ".spv") count++;
+    }
+    return count;
+}
+
+TEST(directory_cache_round_trip) {
+    fs::path dir = test::make_dir("directory_cache");
+
+    DirectoryCacheBackend cache(dir, 1 << 20);
+    Hash key = hash_data("key");
+
+    std::vector<uint32_t> spv;
+    CHECK(!cache.load(key, spv));
+
+    cache.store(key, test_spv(1));
+    CHECK(cache.load(key, spv));
+    CHECK(spv == test_spv(1));
+    CHECK(cache.stats().entries == 1);
+}
+
+TEST(directory_cache_adopts_files_without_an_index) {
+    fs::path dir = test::make_dir("directory_cache_adopt");
+    {
+        DirectoryCacheBackend cache(dir, 1 << 20);
+        for (uint32_t i = 0; i < 10; ++i) cache.store(hash_data(std::to_string(i)), test_spv(i));
+    }
+    fs::remove(dir / "index");
+
+    DirectoryCacheBackend cache(dir, 1 << 20);
+    CHECK(cache.stats().entries == 10);
+    CHECK(cache.stats().bytes == 10 * test_spv(0).size() * sizeof(uint32_t));
+}
+
+TEST(directory_cache_forgets_entries_deleted_behind_its_back) {
+    fs::path dir = test::make_dir("directory_cache_deleted");
+
+    DirectoryCacheBackend cache(dir, 1 << 20);
+    cache.store(hash_data("key"), test_spv(1));
+    CHECK(cache.stats().entries == 1);
+
+    for (auto& file : fs::recursive_directory_iterator(dir)) {
+        if (file.path().extension() == ".spv") fs::remove(file.path());
+    }
+
+    std::vector<uint32_t> spv;
+    CHECK(!cache.load(hash_data("key"), spv));
+    CHECK(cache.stats().entries == 0);
+    CHECK(cache.stats().bytes == 0);
+}
+
+// stores racing the trims must leave the index and the files agreeing
+TEST(directory_cache_trim_keeps_index_and_files_in_sync) {
+    fs::path dir             = test::make_dir("directory_cache_trim");
+    const uint64_t max_bytes = 64 << 10;
+    const size_t entry_words = 1024;
+    const uint32_t key_count = 64;
+    {
+        DirectoryCacheBackend cache(dir, max_bytes);
+
+        std::vector<std::thread> threads;
+        for (uint32_t t = 0; t < 4; ++t) {
+            threads.emplace_back([&, t] {
+                for (uint32_t i = 0; i < 500; ++i) {
+                    uint32_t id = (i * 7 + t) % key_count;
+                    cache.store(hash_data(std::to_string(id)), test_spv(id, entry_words));
+                }
+            });
+        }
+        for (auto& thread : threads) thread.join();
+    }
+
+    // reopened once the trims are done
+    DirectoryCacheBackend cache(dir, max_bytes);
+    CHECK(cache.stats().bytes <= max_bytes);
+    CHECK(cache.stats().entries == count_cache_files(dir));
+    CHECK(cache.stats().bytes == count_cache_files(dir) * entry_words * sizeof(uint32_t));
+}
+
+TEST(memory_cache_drops_the_oldest_entries) {
+    const size_t entry_bytes = test_spv(0).size() * sizeof(uint32_t);
+    MemoryCacheBackend cache(3 * entry_bytes);
+
+    for (uint32_t i = 0; i < 4; ++i) cache.store(hash_data(std::to_string(i)), test_spv(i));
+
+    std::vector<uint32_t> spv;
+    CHECK(!cache.load(hash_data("0"), spv));
+    for (uint32_t i = 1; i < 4; ++i) {
+        CHECK(cache.load(hash_data(std::to_string(i)), spv));
+        CHECK(spv == test_spv(i));
+    }
+}
+
+// what --watch and --serve rely on, a file truncated in place while it is cached doesn't take the process down
+TEST(include_cache_can_keep_files_it_does_not_map) {
+    fs::path dir     = test::make_dir("include_cache");
+    std::string path = (dir / "common.glsl").native();
+    test::write_file(path, std::string(64 << 10, 'a'));
+
+    IncludeCache& cache = IncludeCache::process_cache();
+    cache.set_map_files(false);
+
+    auto file = cache.get(path, nullptr);
+
+    // the same inode, unlike test::write_file
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << "b";
+
+    CHECK(file->content == std::string(64 << 10, 'a'));
+
+    cache.revalidate();
+    CHECK(cache.get(path, nullptr)->content == "b");
+
+    cache.set_map_files(true);
+}
+
+const size_t SHM_TEST_BUDGET = 4 * 1024 * 1024;
+
+static std::string shm_test_name(std::string_view name) {
+    return "/shader_compiler_test-" + std::string(name) + "-" + std::to_string(getpid());
+}
+
+TEST(shm_cache_is_shared_between_instances) {
+    std::string name = shm_test_name("shared");
+    Hash key         = hash_data("key");
+    {
+        SharedMemoryCache writer(name.c_str(), SHM_TEST_BUDGET);
+        SharedMemoryCache reader(name.c_str(), SHM_TEST_BUDGET);
+
+        std::vector<char> value;
+        CHECK(!reader.get(key, value));
+
+        writer.put(key, "value");
+        CHECK(reader.get(key, value));
+        CHECK(std::string(value.begin(), value.end()) == "value");
+    }
+    shm_unlink(name.c_str());
+}
+
+// a process that died before setting its segment up leaves it empty or without the magic
+TEST(shm_cache_recovers_segments_left_uninitialized) {
+    for (size_t size : {size_t(0), SHM_TEST_BUDGET}) {
+        std::string name = shm_test_name("uninitialized");
+
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        CHECK(fd >= 0);
+        CHECK(ftruncate(fd, size) == 0);
+        close(fd);
+
+        {
+            SharedMemoryCache cache(name.c_str(), SHM_TEST_BUDGET);
+
+            std::vector<char> value;
+            cache.put(hash_data("key"), "value");
+            CHECK(cache.get(hash_data("key"), value));
+            CHECK(std::string(value.begin(), value.end()) == "value");
+        }
+        shm_unlink(name.c_str());
+    }
+}
+
+// unix socket paths are short, so these don't go into the test directory
+static std::string socket_test_path(std::string_view name) {
+    return (fs::temp_directory_path() / ("shader_compiler_test-" + std::string(name) + "-" + std::to_string(getpid()) + ".sock")).native();
+}
+
+static const std::vector<uint32_t> TEST_SPV = test_spv(1);
+
+TEST(remote_cache_round_trip) {
+    fs::path dir       = test::make_dir("remote_cache");
+    std::string socket = socket_test_path("remote_cache");
+
+    // the server never returns and goes away with the test process
+    std::thread([socket, cache_dir = (dir / "cache").native()] { run_cache_server(socket.c_str(), cache_dir.c_str()); }).detach();
+
+    int probe = -1;
+    for (int i = 0; i < 100 && probe < 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        probe = connect_unix_socket(socket.c_str());
+    }
+    CHECK(probe >= 0);
+    close(probe);
+
+    RemoteCacheBackend cache(socket.c_str());
+    Hash key = hash_data("remote_cache_round_trip");
+
+    std::vector<uint32_t> spv;
+    CHECK(!cache.load(key, spv));
+
+    // uploads happen in the background
+    cache.store(key, TEST_SPV);
+    for (int i = 0; i < 100 && !cache.load(key, spv); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    CHECK(spv == TEST_SPV);
+
+    // lookups from several threads at once each get an answer
+    std::vector<std::thread> threads;
+    std::atomic<int> hits = 0;
+    for (int i = 0; i < 8; ++i) {
+        threads.emplace_back([&] {
+            std::vector<uint32_t> thread_spv;
+            if (cache.load(key, thread_spv) && thread_spv == TEST_SPV) hits++;
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    CHECK(hits == 8);
+
+    unlink(socket.c_str());
+}
+
+// a server that accepts connections and answers every lookup with answer, or never if it's empty
+static void run_fake_cache_server(int listen_socket, std::string answer) {
+    while (true) {
+        int socket = accept(listen_socket, nullptr, nullptr);
+        if (socket < 0) return;
+
+        std::thread([socket, answer] {
+            char request[1 + sizeof(Hash)];
+            while (read_all(socket, request, sizeof(request))) {
+                if (answer.empty()) {
+                    std::this_thread::sleep_for(std::chrono::seconds(30));
+                    break;
+                }
+                if (!write_str(socket, answer)) break;
+            }
+            close(socket);
+        }).detach();
+    }
+}
+
+TEST(remote_cache_falls_back_when_the_server_hangs_or_misbehaves) {
+    uint32_t huge_size = 0xfffffff0;
+    std::string huge_answer(reinterpret_cast<const char*>(&huge_size), sizeof(huge_size));
+
+    for (std::string answer : {std::string(), huge_answer}) {
+        std::string socket = socket_test_path("fake_remote_cache");
+
+        int listen_socket = listen_unix_socket(socket.c_str());
+        CHECK(listen_socket >= 0);
+        std::thread(run_fake_cache_server, listen_socket, answer).detach();
+
+        RemoteCacheBackend cache(socket.c_str());
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<uint32_t> spv;
+        CHECK(!cache.load(hash_data("key"), spv));
+        CHECK(spv.empty());
+
+        // once it's lost every lookup is an immediate miss
+        CHECK(!cache.load(hash_data("key"), spv));
+        CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(10));
+
+        shutdown(listen_socket, SHUT_RDWR);
+        unlink(socket.c_str());
+    }
+}
+
+int main() {
+    return test::run_all();
+}
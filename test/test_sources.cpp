@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <string>
+
+#include "include_cache.hpp"
+#include "include_scanner.hpp"
+#include "shader_compiler.hpp"
+#include "test.hpp"
+#include "unused_functions.hpp"
+
+namespace fs = std::filesystem;
+
+// the text the compiler is given for a stage: the includes it expands to and the functions stripped from it
+
+static const char* LIBRARY_SHADER = R"(#version 450
+layout(location = 0) out vec4 color_out;
+
+float brdf(float x) {
+    return x * 0.5;
+}
+
+float noise(float x) {
+    return fract(sin(x) * 43758.5453);
+}
+
+float noise(vec2 x) {
+    return noise(x.x) + noise(x.y);
+}
+
+vec3 pack_normal(vec3 n) {
+    return n * 0.5 + 0.5;
+}
+
+void main() {
+    color_out = vec4(brdf(1.0));
+}
+)";
+
+static size_t count_lines(const std::string& text) {
+    return std::count(text.begin(), text.end(), '\n');
+}
+
+static size_t count_occurrences(const std::string& text, std::string_view part) {
+    size_t count = 0;
+    for (size_t pos = text.find(part); pos != std::string::npos; pos = text.find(part, pos + 1)) count++;
+    return count;
+}
+
+// main.frag in dir with the given source, preprocessed like a stage of a build without debug info
+static std::string preprocess_main(const fs::path& dir, const std::string& source) {
+    // the files of earlier cases may have been replaced
+    IncludeCache::process_cache().revalidate();
+
+    ShaderCompilerContext context(CompilerSettings{.debug_info = false});
+    return context.preprocess((dir / "main.frag").native(), VK_SHADER_STAGE_FRAGMENT_BIT, source, {});
+}
+
+TEST(unreachable_functions_are_stripped_with_their_lines_kept) {
+    std::string stripped = strip_unused_functions(LIBRARY_SHADER);
+
+    CHECK(stripped.find("float brdf(float x)") != std::string::npos);
+    CHECK(stripped.find("void main()") != std::string::npos);
+    CHECK(stripped.find("noise") == std::string::npos);
+    CHECK(stripped.find("pack_normal") == std::string::npos);
+
+    // errors still point at the lines of the source
+    CHECK(count_lines(stripped) == count_lines(LIBRARY_SHADER));
+}
+
+TEST(overloads_are_kept_together) {
+    std::string source = std::string(LIBRARY_SHADER) + "float use_noise() {\n    return noise(vec2(1.0));\n}\nconst float VALUE = use_noise();\n";
+    std::string stripped = strip_unused_functions(source);
+
+    // use_noise only calls the vec2 overload, the float one is kept along with it
+    CHECK(stripped.find("float noise(float x)") != std::string::npos);
+    CHECK(stripped.find("float noise(vec2 x)") != std::string::npos);
+    CHECK(stripped.find("float use_noise()") != std::string::npos);
+    CHECK(stripped.find("pack_normal") == std::string::npos);
+}
+
+TEST(functions_with_directives_and_unbalanced_text_are_kept) {
+    std::string with_directive = "float unused() {\n#line 20\n    return 1.0;\n}\nvoid main() {\n}\n";
+    CHECK(strip_unused_functions(with_directive) == with_directive);
+
+    std::string unbalanced = "float unused() {\n    return 1.0;\n\nvoid main() {\n}\n";
+    CHECK(strip_unused_functions(unbalanced) == unbalanced);
+
+    std::string no_functions = "#version 450\nlayout(location = 0) out vec4 color_out;\n";
+    CHECK(strip_unused_functions(no_functions) == no_functions);
+}
+
+TEST(preprocess_strips_only_when_enabled_without_debug_info) {
+    std::string source = LIBRARY_SHADER;
+
+    CompilerSettings stripping{.debug_info = false, .strip_unused_functions = true};
+    CompilerSettings not_stripping{.debug_info = false};
+    CompilerSettings debug_info{.debug_info = true, .strip_unused_functions = true};
+
+    ShaderCompilerContext stripping_context(stripping);
+    ShaderCompilerContext not_stripping_context(not_stripping);
+    ShaderCompilerContext debug_info_context(debug_info);
+
+    CHECK(stripping_context.strips_unused_functions());
+    CHECK(!not_stripping_context.strips_unused_functions());
+    CHECK(!debug_info_context.strips_unused_functions());
+
+    CHECK(stripping_context.preprocess("library.frag", VK_SHADER_STAGE_FRAGMENT_BIT, source, {}).find("pack_normal") == std::string::npos);
+    CHECK(not_stripping_context.preprocess("library.frag", VK_SHADER_STAGE_FRAGMENT_BIT, source, {}).find("pack_normal") != std::string::npos);
+
+    // a stripped compile is a different compile, one that isn't must not be told apart from before
+    CHECK(stripping_context.options_key().find("strip-unused-functions") != std::string::npos);
+    CHECK(not_stripping_context.options_key().find("strip-unused-functions") == std::string::npos);
+    CHECK(debug_info_context.options_key().find("strip-unused-functions") == std::string::npos);
+}
+
+TEST(include_guards_are_recognized) {
+    IncludeGuardInfo guarded = analyze_include_guard("// comment\n#ifndef LIB_H\n#define LIB_H\n#if X\n#endif\nint x;\n#endif\n");
+    CHECK(guarded.guard_macro == "LIB_H");
+    CHECK(!guarded.pragma_once);
+
+    CHECK(analyze_include_guard("#pragma once\nint x;\n").pragma_once);
+    CHECK(!analyze_include_guard("#ifndef ONCE_OFF\n#pragma once\n#endif\nint x;\n").pragma_once);
+    CHECK(analyze_include_guard("#ifndef LIB_H\n#define LIB_H\n#endif\nint trailing;\n").guard_macro.empty());
+    CHECK(analyze_include_guard("#ifndef LIB_H\n#define LIB_H\n#else\nint x;\n#endif\n").guard_macro.empty());
+    CHECK(analyze_include_guard("#ifndef LIB_H\n#define LIB_H\n#endif\n#undef OTHER\n").undefined_macros == std::vector<std::string>({"OTHER"}));
+}
+
+TEST(guarded_includes_expand_once) {
+    fs::path dir = test::make_dir("guarded_includes");
+    test::write_file(dir / "guarded.glsl", "#ifndef GUARDED_H\n#define GUARDED_H\nconst int GUARDED = 1;\n#endif\n");
+    test::write_file(dir / "once.glsl", "#pragma once\nconst int ONCE = 1;\n");
+
+    std::string preprocessed = preprocess_main(dir, "#include \"guarded.glsl\"\n#include \"once.glsl\"\n#include \"guarded.glsl\"\n#include \"once.glsl\"\n");
+    CHECK(count_occurrences(preprocessed, "GUARDED = 1") == 1);
+    CHECK(count_occurrences(preprocessed, "ONCE = 1") == 1);
+}
+
+TEST(includes_that_are_only_sometimes_once_expand_every_time) {
+    fs::path dir = test::make_dir("conditional_includes");
+    // the #pragma once isn't reached with ONCE_OFF defined
+    test::write_file(dir / "conditional.glsl", "#ifndef ONCE_OFF\n#pragma once\n#endif\nconst int CONDITIONAL = 1;\n");
+    // only the part inside the guard is skipped the second time
+    test::write_file(dir / "trailing.glsl", "#ifndef TRAILING_H\n#define TRAILING_H\nconst int GUARDED = 1;\n#endif\nconst int TRAILING = 1;\n");
+
+    std::string preprocessed = preprocess_main(dir, "#define ONCE_OFF\n#include \"conditional.glsl\"\n#include \"conditional.glsl\"\n"
+                                                    "#include \"trailing.glsl\"\n#include \"trailing.glsl\"\n");
+    CHECK(count_occurrences(preprocessed, "CONDITIONAL = 1") == 2);
+    CHECK(count_occurrences(preprocessed, "GUARDED = 1") == 1);
+    CHECK(count_occurrences(preprocessed, "TRAILING = 1") == 2);
+}
+
+TEST(includes_resolve_next_to_the_includer_then_in_include_dir_order) {
+    fs::path dir = test::make_dir("resolve_order");
+    test::write_file(dir / "shaders/lib.glsl", "");
+    test::write_file(dir / "first/lib.glsl", "");
+    test::write_file(dir / "second/lib.glsl", "");
+    test::write_file(dir / "second/only_second.glsl", "");
+
+    IncludeCache& cache = IncludeCache::process_cache();
+    cache.set_include_dirs({(dir / "first").native(), (dir / "second").native()});
+    std::string includer = (dir / "shaders/main.frag").native();
+
+    std::string path;
+    CHECK(cache.resolve(includer, "lib.glsl", true, path) && path == (dir / "shaders/lib.glsl").native());
+    CHECK(cache.resolve(includer, "lib.glsl", false, path) && path == (dir / "first/lib.glsl").native());
+    CHECK(cache.resolve(includer, "only_second.glsl", true, path) && path == (dir / "second/only_second.glsl").native());
+    CHECK(!cache.resolve(includer, "missing.glsl", true, path));
+
+    // the lookup is remembered, also that there was nothing
+    test::write_file(dir / "shaders/missing.glsl", "");
+    fs::remove(dir / "first/lib.glsl");
+    CHECK(!cache.resolve(includer, "missing.glsl", true, path));
+    CHECK(cache.resolve(includer, "lib.glsl", false, path) && path == (dir / "first/lib.glsl").native());
+
+    // until the files may have changed
+    cache.revalidate();
+    CHECK(cache.resolve(includer, "missing.glsl", true, path) && path == (dir / "shaders/missing.glsl").native());
+    CHECK(cache.resolve(includer, "lib.glsl", false, path) && path == (dir / "second/lib.glsl").native());
+
+    cache.set_include_dirs({});
+}
+
+static std::vector<std::string> directive_names(std::string_view source) {
+    std::vector<IncludeDirective> directives;
+    find_include_directives(source, directives);
+
+    std::vector<std::string> names;
+    for (auto& directive : directives) {
+        names.push_back(std::string(directive.relative ? "\"" : "<") + directive.name);
+    }
+    return names;
+}
+
+TEST(include_directives_are_found_without_evaluating_conditions) {
+    CHECK(directive_names("#include \"a.glsl\"\n  #  include <b.glsl>\nint x; #include \"c.glsl\"\n") == std::vector<std::string>({"\"a.glsl", "<b.glsl"}));
+
+    // a commented out include is no dependency, a skipped one may be
+    CHECK(directive_names("// #include \"commented.glsl\"\n#if 0\n#include \"skipped.glsl\"\n#endif\n") == std::vector<std::string>({"\"skipped.glsl"}));
+    CHECK(directive_names("/*\n#include \"block.glsl\"\n*/\n") == std::vector<std::string>({"\"block.glsl"}));
+}
+
+TEST(include_scan_reaches_every_file_once) {
+    fs::path dir = test::make_dir("include_scan");
+    test::write_file(dir / "main.frag", "#include \"a.glsl\"\n#ifdef NEVER\n#include \"b.glsl\"\n#endif\n// #include \"commented.glsl\"\n#include \"missing.glsl\"\n");
+    test::write_file(dir / "a.glsl", "#include \"b.glsl\"\n");
+    test::write_file(dir / "b.glsl", "#include \"a.glsl\"\n#include \"main.frag\"\n");
+    test::write_file(dir / "commented.glsl", "");
+    IncludeCache::process_cache().revalidate();
+
+    IncludeScanner scanner;
+    StageInputs inputs = scanner.scan((dir / "main.frag").native());
+
+    std::vector<std::string> paths;
+    for (auto& [path, content_hash] : inputs) {
+        paths.push_back(fs::path(path).filename().native());
+    }
+    CHECK(paths == std::vector<std::string>({"main.frag", "a.glsl", "b.glsl"}));
+
+    bool threw = false;
+    try {
+        scanner.scan((dir / "missing.frag").native());
+    } catch (const std::exception&) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+int main() {
+    return test::run_all();
+}